@@ -15,7 +15,7 @@
 extern "C" {
 #endif
 
-/* atomic add */
+/* atomic add. FL2_atomic64 is for byte counts, which can exceed 2 GB in one block. */
 
 #if !defined(FL2_SINGLETHREAD) && defined(_WIN32)
 
@@ -42,6 +42,9 @@ typedef LONG volatile FL2_atomic;
 #define FL2_atomic_add(n, a) InterlockedAdd(&n, a)
 #define FL2_nonAtomic_increment(n) (++n)
 
+typedef LONG64 volatile FL2_atomic64;
+#define FL2_atomic_add64(n, a) InterlockedAdd64(&n, a)
+
 #elif !defined(FL2_SINGLETHREAD) && defined(__GNUC__)
 
 typedef long FL2_atomic;
@@ -50,6 +53,9 @@ typedef long FL2_atomic;
 #define FL2_atomic_add(n, a) __sync_fetch_and_add(&n, a)
 #define FL2_nonAtomic_increment(n) (n++)
 
+typedef long long FL2_atomic64;
+#define FL2_atomic_add64(n, a) __sync_fetch_and_add(&n, a)
+
 #elif !defined(FL2_SINGLETHREAD) && defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L) && !defined(__STDC_NO_ATOMICS__) /* C11 */
 
 #include <stdatomic.h>
@@ -60,6 +66,9 @@ typedef _Atomic long FL2_atomic;
 #define FL2_atomic_add(n, a) atomic_fetch_add(&n, a)
 #define FL2_nonAtomic_increment(n) (n++)
 
+typedef _Atomic long long FL2_atomic64;
+#define FL2_atomic_add64(n, a) atomic_fetch_add(&n, a)
+
 #else  /* No atomics */
 
 #	ifndef FL2_SINGLETHREAD
@@ -72,6 +81,9 @@ typedef long FL2_atomic;
 #define FL2_atomic_add(n, a) (n += (a))
 #define FL2_nonAtomic_increment(n) (n++)
 
+typedef long long FL2_atomic64;
+#define FL2_atomic_add64(n, a) (n += (a))
+
 #endif /* FL2_SINGLETHREAD */
 
 
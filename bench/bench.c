@@ -18,6 +18,52 @@
 
 static U32 g_nbSeconds = 0;
 static unsigned g_iterations = 2;
+static int g_builderStats = 0;
+static int g_matchAnalysis = 0;
+static unsigned g_largePages = 0;
+
+/* Encoder variants tried on each block with -ev */
+static const FL2_encoderParameters g_variants[FL2_ENCODER_VARIANTS_MAX] = {
+    { FL2_opt, 3, 0, 2, 48, 1, 9 },
+    { FL2_ultra, 0, 2, 2, 64, 2, 10 },
+    { FL2_ultra, 4, 0, 0, 96, 4, 11 },
+    { FL2_ultra, 1, 0, 2, 128, 8, 12 }
+};
+
+static void print_builder_stats(FL2_CCtx* fcs)
+{
+    unsigned const threads = FL2_getCCtxThreadCount(fcs);
+    for (unsigned t = 0; t < threads; ++t) {
+        FL2_builderStats stats;
+        if (FL2_isError(FL2_getCCtxBuilderStats(fcs, t, &stats)))
+            return;
+        printf("  thread %2u : %8llu lists, %6llu steals, %3llu splits, %9llu us busy, %8llu us idle\r\n",
+            t, stats.lists, stats.steals, stats.splits, stats.busyMicro, stats.idleMicro);
+        printf("              %8llu brute, %8llu buffered, %6llu partitioned, %6llu bound, %6llu modeled, %5llu explored\r\n",
+            stats.bruteLists, stats.bufferedLists, stats.partitionLists, stats.boundLists, stats.modelLists, stats.exploredLists);
+        printf("              %8llu overflowed, %9llu positions, %9llu us overflow, %8llu buffer\r\n",
+            stats.overflowLists, stats.overflowPositions, stats.overflowMicro, stats.bufferSize);
+        printf("              %8llu degraded lists, %8llu degraded searches\r\n",
+            stats.degradedLists, stats.degradedSearches);
+    }
+}
+
+/* One line of space-separated key=value pairs. Distances are in buckets by highest bit. */
+static void print_match_quality(FL2_CCtx* fcs, int level)
+{
+    FL2_matchQuality q;
+    if (FL2_isError(FL2_getCCtxMatchQuality(fcs, &q)))
+        return;
+    printf("match_quality level=%d positions=%llu radix_matches=%llu ref_matches=%llu shorter=%llu length_deficit=%llu missed_long=%llu radix_cost=%llu ref_cost=%llu",
+        level, q.positions, q.radixMatches, q.refMatches, q.shorter, q.lengthDeficit, q.missedLong, q.radixCost, q.refCost);
+    printf(" radix_dist=");
+    for (unsigned i = 0; i < FL2_MATCHQ_DIST_BUCKETS; ++i)
+        printf("%s%llu", i ? "," : "", q.radixDist[i]);
+    printf(" ref_dist=");
+    for (unsigned i = 0; i < FL2_MATCHQ_DIST_BUCKETS; ++i)
+        printf("%s%llu", i ? "," : "", q.refDist[i]);
+    printf("\r\n");
+}
 
 static void benchmark(FL2_CCtx* fcs, FL2_DCtx* dctx, char* srcBuffer, size_t srcSize, char* compressedBuffer, size_t maxCompressedSize,
     char* resultBuffer)
@@ -175,18 +221,70 @@ static int parse_params(FL2_CCtx* fcs, int argc, char** argv)
         else if (strcmp(param, "b") == 0) {
             FL2_CCtx_setParameter(fcs, FL2_p_bufferResize, value);
         }
+        else if (strcmp(param, "bc") == 0) {
+            FL2_CCtx_setParameter(fcs, FL2_p_bufferCeiling, value);
+        }
         else if (strcmp(param, "a") == 0) {
             FL2_CCtx_setParameter(fcs, FL2_p_strategy, value);
         }
         else if (strcmp(param, "h") == 0) {
             FL2_CCtx_setParameter(fcs, FL2_p_doXXHash, value);
         }
+        else if (strcmp(param, "ro") == 0) {
+            FL2_CCtx_setParameter(fcs, FL2_p_reuseOverlap, value);
+        }
+        else if (strcmp(param, "lp") == 0) {
+            g_largePages = value;
+        }
+        else if (strcmp(param, "nu") == 0) {
+            FL2_CCtx_setParameter(fcs, FL2_p_numaPolicy, value);
+        }
+        else if (strcmp(param, "pd") == 0) {
+            FL2_CCtx_setParameter(fcs, FL2_p_prefetchDistance, value);
+        }
+        else if (strcmp(param, "tb") == 0) {
+            FL2_CCtx_setParameter(fcs, FL2_p_radix24, value);
+        }
+        else if (strcmp(param, "ad") == 0) {
+            FL2_CCtx_setParameter(fcs, FL2_p_adaptiveDepth, value);
+        }
+        else if (strcmp(param, "so") == 0) {
+            FL2_CCtx_setParameter(fcs, FL2_p_separateOutput, value);
+        }
+        else if (strcmp(param, "sa") == 0) {
+            FL2_CCtx_setParameter(fcs, FL2_p_suffixArray, value);
+        }
+        else if (strcmp(param, "si") == 0) {
+            FL2_CCtx_setParameter(fcs, FL2_p_smallInput, value);
+        }
+        else if (strcmp(param, "sl") == 0) {
+            FL2_CCtx_setParameter(fcs, FL2_p_sliceSize, value);
+        }
+        else if (strcmp(param, "lr") == 0) {
+            FL2_CCtx_setParameter(fcs, FL2_p_linkRepeats, value);
+        }
+        else if (strcmp(param, "wb") == 0) {
+            FL2_CCtx_setParameter(fcs, FL2_p_workBudget, value);
+        }
+        else if (strcmp(param, "cm") == 0) {
+            FL2_CCtx_setParameter(fcs, FL2_p_costModel, value);
+        }
+        else if (strcmp(param, "ev") == 0) {
+            FL2_setCCtxEncoderVariants(fcs, g_variants, value);
+        }
         else if (strcmp(param, "x") == 0) {
             FL2_CCtx_setParameter(fcs, FL2_p_highCompression, value);
         }
         else if (strcmp(param, "e") == 0) {
             end_level = value;
         }
+        else if (strcmp(param, "s") == 0) {
+            g_builderStats = 1;
+        }
+        else if (strcmp(param, "ma") == 0) {
+            FL2_CCtx_setParameter(fcs, FL2_p_matchAnalysis, value);
+            g_matchAnalysis = value != 0;
+        }
 #ifdef RMF_REFERENCE
         else if (strcmp(param, "r") == 0) {
             FL2_CCtx_setParameter(fcs, FL2_p_useReferenceMF, value);
@@ -243,9 +341,23 @@ int FL2LIB_CALL main(int argc, char** argv)
     else if (end_level > FL2_maxCLevel())
         end_level = FL2_maxCLevel();
     for (; level <= end_level; ++level) {
+        if (g_largePages) {
+            /* Run with normal pages first for comparison */
+            FL2_CCtx_setParameter(fcs, FL2_p_largePages, 0);
+            benchmark(fcs, dctx, src, size, compressedBuffer, maxCompressedSize, resultBuffer);
+            printf("%u normal pages\r\n", level);
+            FL2_CCtx_setParameter(fcs, FL2_p_largePages, g_largePages);
+        }
         benchmark(fcs, dctx, src, size, compressedBuffer, maxCompressedSize, resultBuffer);
         FL2_CCtx_setParameter(fcs, FL2_p_compressionLevel, level + 1);
-        printf("%u\r\n", level);
+        if (g_largePages)
+            printf("%u large pages : %u KiB\r\n", level, (unsigned)(FL2_getCCtxLargePageSize(fcs) >> 10));
+        else
+            printf("%u\r\n", level);
+        if (g_builderStats)
+            print_builder_stats(fcs);
+        if (g_matchAnalysis)
+            print_match_quality(fcs, level);
     }
     FL2_freeDCtx(dctx);
     FL2_freeCCtx(fcs);
@@ -13,6 +13,18 @@
 
 #include "mem.h"
 
+/* Vector compare kernels are used when the compiler targets SSE2 or AVX2.
+ * Define ZSTD_COUNT_NO_SIMD to use only the scalar word compare. */
+#if !defined(ZSTD_COUNT_NO_SIMD) && (defined(__GNUC__) || defined(_MSC_VER))
+#  if defined(__AVX2__)
+#    include <immintrin.h>
+#    define ZSTD_COUNT_VECTOR 32
+#  elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#    include <emmintrin.h>
+#    define ZSTD_COUNT_VECTOR 16
+#  endif
+#endif
+
 #if defined (__cplusplus)
 extern "C" {
 #endif
@@ -96,6 +108,35 @@ static unsigned ZSTD_NbCommonBytes(register size_t val)
 }
 
 
+#ifdef ZSTD_COUNT_VECTOR
+
+/* Returns a mask with one bit set for each of the ZSTD_COUNT_VECTOR bytes that differ */
+static U32 ZSTD_vectorMismatch(const BYTE* const pIn, const BYTE* const pMatch)
+{
+#  if ZSTD_COUNT_VECTOR == 32
+    __m256i const a = _mm256_loadu_si256((const __m256i*)pIn);
+    __m256i const b = _mm256_loadu_si256((const __m256i*)pMatch);
+    return ~(U32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b));
+#  else
+    __m128i const a = _mm_loadu_si128((const __m128i*)pIn);
+    __m128i const b = _mm_loadu_si128((const __m128i*)pMatch);
+    return (U32)_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) ^ 0xFFFF;
+#  endif
+}
+
+static unsigned ZSTD_vectorFirstBit(U32 const mask)
+{
+#  if defined(_MSC_VER)
+    unsigned long r = 0;
+    _BitScanForward(&r, mask);
+    return (unsigned)r;
+#  else
+    return (unsigned)__builtin_ctz(mask);
+#  endif
+}
+
+#endif /* ZSTD_COUNT_VECTOR */
+
 static size_t ZSTD_count(const BYTE* pIn, const BYTE* pMatch, const BYTE* const pInLimit)
 {
     const BYTE* const pStart = pIn;
@@ -105,6 +146,17 @@ static size_t ZSTD_count(const BYTE* pIn, const BYTE* pMatch, const BYTE* const
         { size_t const diff = MEM_readST(pMatch) ^ MEM_readST(pIn);
         if (diff) return ZSTD_NbCommonBytes(diff); }
         pIn += sizeof(size_t); pMatch += sizeof(size_t);
+#ifdef ZSTD_COUNT_VECTOR
+        /* Most matches end in the first word. Longer ones continue a vector at a time. */
+        while (pInLimit - pIn >= ZSTD_COUNT_VECTOR) {
+            U32 const mismatch = ZSTD_vectorMismatch(pIn, pMatch);
+            if (mismatch) {
+                pIn += ZSTD_vectorFirstBit(mismatch);
+                return (size_t)(pIn - pStart);
+            }
+            pIn += ZSTD_COUNT_VECTOR; pMatch += ZSTD_COUNT_VECTOR;
+        }
+#endif
         while (pIn < pInLoopLimit) {
             size_t const diff = MEM_readST(pMatch) ^ MEM_readST(pIn);
             if (!diff) { pIn += sizeof(size_t); pMatch += sizeof(size_t); continue; }
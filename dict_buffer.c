@@ -11,6 +11,7 @@
 #include <stdlib.h>
 #include "dict_buffer.h"
 #include "fl2_internal.h"
+#include "fl2_alloc.h"
 
 #define ALIGNMENT_SIZE 16U
 #define ALIGNMENT_MASK (~(size_t)(ALIGNMENT_SIZE-1))
@@ -22,6 +23,7 @@ int DICT_construct(DICT_buffer * const buf, int const async)
     buf->data[0] = NULL;
     buf->data[1] = NULL;
     buf->size = 0;
+    buf->large_pages = 0;
 
     buf->async = (async != 0);
 
@@ -32,18 +34,19 @@ int DICT_construct(DICT_buffer * const buf, int const async)
     return 0;
 }
 
-int DICT_init(DICT_buffer * const buf, size_t const dict_size, size_t const overlap, unsigned const reset_multiplier, int const do_hash)
+int DICT_init(DICT_buffer * const buf, size_t const dict_size, size_t const overlap, unsigned const reset_multiplier, int const do_hash, unsigned const large_pages)
 {
-    /* Allocate if not yet allocated or existing dict too small */
-    if (buf->data[0] == NULL || dict_size > buf->size) {
+    /* Allocate if not yet allocated, existing dict too small or page mode changed */
+    if (buf->data[0] == NULL || dict_size > buf->size || large_pages != buf->large_pages) {
         /* Free any existing buffers */
         DICT_destruct(buf);
 
-        buf->data[0] = malloc(dict_size);
+        buf->data[0] = FL2_largeAlloc(dict_size, large_pages);
 
         buf->data[1] = NULL;
         if (buf->async)
-            buf->data[1] = malloc(dict_size);
+            buf->data[1] = FL2_largeAlloc(dict_size, large_pages);
+        buf->large_pages = large_pages;
 
         if (buf->data[0] == NULL || (buf->async && buf->data[1] == NULL)) {
             DICT_destruct(buf);
@@ -82,8 +85,8 @@ int DICT_init(DICT_buffer * const buf, size_t const dict_size, size_t const over
 
 void DICT_destruct(DICT_buffer * const buf)
 {
-    free(buf->data[0]);
-    free(buf->data[1]);
+    FL2_largeFree(buf->data[0]);
+    FL2_largeFree(buf->data[1]);
     buf->data[0] = NULL;
     buf->data[1] = NULL;
     buf->size = 0;
@@ -98,6 +101,19 @@ size_t DICT_size(const DICT_buffer * const buf)
     return buf->size;
 }
 
+unsigned DICT_largePages(const DICT_buffer * const buf)
+{
+    return buf->large_pages;
+}
+
+/* Touch the pages of one of job_count slices of each buffer */
+void DICT_prefault(DICT_buffer * const buf, size_t const job, size_t const job_count)
+{
+    FL2_prefault(buf->data[0], buf->size, job, job_count);
+    if (buf->data[1] != NULL)
+        FL2_prefault(buf->data[1], buf->size, job, job_count);
+}
+
 /* Get the dictionary buffer for adding input */
 size_t DICT_get(DICT_buffer * const buf, void **const dict)
 {
@@ -37,6 +37,7 @@ typedef struct {
     size_t size;   /* allocation size */
     size_t total;  /* total size compressed after last dict reset */
     size_t reset_interval;
+    unsigned large_pages; /* page mode of the allocation */
 #ifndef NO_XXHASH
     XXH32_state_t *xxh;
 #endif
@@ -44,12 +45,16 @@ typedef struct {
 
 int DICT_construct(DICT_buffer *const buf, int const async);
 
-int DICT_init(DICT_buffer *const buf, size_t const dict_size, size_t const overlap, unsigned const reset_multiplier, int const do_hash);
+int DICT_init(DICT_buffer *const buf, size_t const dict_size, size_t const overlap, unsigned const reset_multiplier, int const do_hash, unsigned const large_pages);
 
 void DICT_destruct(DICT_buffer *const buf);
 
 size_t DICT_size(const DICT_buffer *const buf);
 
+unsigned DICT_largePages(const DICT_buffer *const buf);
+
+void DICT_prefault(DICT_buffer *const buf, size_t const job, size_t const job_count);
+
 size_t DICT_get(DICT_buffer *const buf, void **const dict);
 
 int DICT_update(DICT_buffer *const buf, size_t const added_size);
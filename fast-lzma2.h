@@ -162,6 +162,70 @@ FL2LIB_API size_t FL2LIB_CALL FL2_compressCCtx(FL2_CCtx* cctx,
  *  7-zip or XZ compatible LZMA2 stream. */
 FL2LIB_API unsigned char FL2LIB_CALL FL2_getCCtxDictProp(FL2_CCtx* cctx);
 
+/*! FL2_getCCtxBuilderStats() :
+ *  Get match finder scheduling statistics for one thread, accumulated since the start of
+ *  the current or most recent frame. Lists are seeded into per-thread queues, largest first.
+ *  A thread which empties its own queue steals from the others. A list which is too long
+ *  for one thread is split into sub lists which all threads can take.
+ *  With FL2_p_costModel, the recursion path of each list of moderate length is chosen by a cost
+ *  model which learns the work each path takes on the lists of the current frame. The counts of
+ *  each path are included. Lists too long for the match buffer are partitioned in the table first, which is
+ *  slower; their count and cost show whether FL2_p_bufferResize or FL2_p_bufferCeiling is too low.
+ *  With FL2_p_workBudget, each list and each block of the ultra strategy's hash chain search has
+ *  a work budget which bounds the time per byte on pathological data. Work beyond it is skipped
+ *  and counted.
+ *  Returns an error if thread >= FL2_getCCtxThreadCount() or nothing has been compressed. */
+typedef struct {
+    unsigned long long lists;      /* lists taken from the thread's own queue */
+    unsigned long long steals;     /* lists taken from other threads' queues */
+    unsigned long long splits;     /* very long lists split into sub lists for all threads to process */
+    unsigned long long busyMicro;  /* time spent building the match table */
+    unsigned long long idleMicro;  /* time spent waiting for other threads to finish building */
+    unsigned long long boundLists;     /* lists near the block end, parsed with bounds checks */
+    unsigned long long bruteLists;     /* lists and sub lists short enough to compare each with all others */
+    unsigned long long bufferedLists;  /* lists and sub lists recursed in the match buffer */
+    unsigned long long partitionLists; /* lists partitioned by 2 more bytes in the table first */
+    unsigned long long modelLists;     /* lists given a path by the cost model */
+    unsigned long long exploredLists;  /* of those, lists given a path other than the cheapest */
+    unsigned long long overflowLists;     /* lists too long for the match buffer */
+    unsigned long long overflowPositions; /* total count of those lists */
+    unsigned long long overflowMicro;     /* time spent on those lists */
+    unsigned long long bufferSize;        /* current match buffer size in entries */
+    unsigned long long degradedLists;     /* lists which ran out of work budget and were left shorter */
+    unsigned long long degradedSearches;  /* hash chain searches of the encoder on the same thread cut short by the budget */
+} FL2_builderStats;
+
+FL2LIB_API size_t FL2LIB_CALL FL2_getCCtxBuilderStats(const FL2_CCtx* cctx, unsigned thread, FL2_builderStats* stats);
+
+/*! FL2_getCCtxMatchQuality() :
+ *  Get the match finder quality analysis accumulated since the start of the current or most
+ *  recent frame. Nothing is accumulated unless FL2_p_matchAnalysis is set. Each block is parsed
+ *  again by the slow reference match finder to the maximum depth, and the match the encoder
+ *  would get from each table is compared at every position. Costs are from a greedy parse with
+ *  a rough LZMA price model, so only the difference between them is meaningful.
+ *  Returns an error if nothing has been compressed. */
+#define FL2_MATCHQ_DIST_BUCKETS 32
+#define FL2_MATCHQ_LONG_LENGTH 32
+typedef struct {
+    unsigned long long positions;     /* positions compared */
+    unsigned long long radixMatches;  /* positions with a match from the radix match finder */
+    unsigned long long refMatches;    /* positions with a match from the reference match finder */
+    unsigned long long shorter;       /* positions where the radix match is shorter than the reference match */
+    unsigned long long lengthDeficit; /* total length by which the radix matches are shorter */
+    unsigned long long missedLong;    /* reference matches of at least FL2_MATCHQ_LONG_LENGTH where the radix match is shorter than that */
+    unsigned long long radixDist[FL2_MATCHQ_DIST_BUCKETS]; /* radix matches by highest bit of the distance */
+    unsigned long long refDist[FL2_MATCHQ_DIST_BUCKETS];   /* reference matches by highest bit of the distance */
+    unsigned long long radixCost;     /* estimated compressed bytes using the radix matches */
+    unsigned long long refCost;       /* estimated compressed bytes using the reference matches */
+} FL2_matchQuality;
+
+FL2LIB_API size_t FL2LIB_CALL FL2_getCCtxMatchQuality(const FL2_CCtx* cctx, FL2_matchQuality* quality);
+
+/*! FL2_getCCtxLargePageSize() :
+ *  Get the large page size backing the match table, or 0 if it uses normal pages.
+ *  Transparent huge pages are reported if the system accepted the request for them. */
+FL2LIB_API size_t FL2LIB_CALL FL2_getCCtxLargePageSize(const FL2_CCtx* cctx);
+
 
 /****************************
 *  Decompression
@@ -452,9 +516,10 @@ FL2LIB_API size_t FL2LIB_CALL FL2_decompressStream(FL2_DStream* fds, FL2_outBuff
 
 #define FL2_DICTLOG_MIN      20
 #define FL2_DICTLOG_MAX_32   27
-#define FL2_DICTLOG_MAX_64   30
+#define FL2_DICTLOG_MAX_64   32
 #define FL2_DICTLOG_MAX      ((unsigned)(sizeof(size_t) == 4 ? FL2_DICTLOG_MAX_32 : FL2_DICTLOG_MAX_64))
-#define FL2_DICTSIZE_MAX     (1U << FL2_DICTLOG_MAX)
+#define FL2_DICTSIZE_MAX_64  ((size_t)0xFFFFFFFCU) /* 4 Gb less the margin needed to keep LZMA2 distance codes within 32 bits */
+#define FL2_DICTSIZE_MAX     (sizeof(size_t) == 4 ? ((size_t)1 << FL2_DICTLOG_MAX_32) : FL2_DICTSIZE_MAX_64)
 #define FL2_DICTSIZE_MIN     (1U << FL2_DICTLOG_MIN)
 #define FL2_BLOCK_OVERLAP_MIN 0
 #define FL2_BLOCK_OVERLAP_MAX 14
@@ -463,6 +528,8 @@ FL2LIB_API size_t FL2LIB_CALL FL2_decompressStream(FL2_DStream* fds, FL2_outBuff
 #define FL2_BUFFER_RESIZE_MIN 0
 #define FL2_BUFFER_RESIZE_MAX 4
 #define FL2_BUFFER_RESIZE_DEFAULT 2
+#define FL2_BUFFER_CEILING_MIN 1
+#define FL2_BUFFER_CEILING_MAX 128 /* Mb; 2^24 match buffer entries */
 #define FL2_CHAINLOG_MIN       4
 #define FL2_CHAINLOG_MAX       14
 #define FL2_HYBRIDCYCLES_MIN    1
@@ -478,6 +545,15 @@ FL2LIB_API size_t FL2LIB_CALL FL2_decompressStream(FL2_DStream* fds, FL2_outBuff
 #define FL2_PB_MIN 0
 #define FL2_PB_MAX 4
 #define FL2_LCLP_MAX 4
+#define FL2_LARGEPAGES_MAX 2
+#define FL2_NUMAPOLICY_MAX 64
+#define FL2_PREFETCH_DISTANCE_MAX 16
+#define FL2_PREFETCH_DISTANCE_DEFAULT 0
+#define FL2_SMALL_INPUT_MAX ((size_t)4 << 20)
+#define FL2_SMALL_INPUT_DEFAULT 0
+#define FL2_SLICE_SIZE_MIN ((size_t)4 << 10)
+#define FL2_SLICE_SIZE_MAX FL2_DICTSIZE_MAX
+#define FL2_SLICE_SIZE_DEFAULT ((size_t)0x1C000) /* Enough for 8 threads, 1 Mb dict, 2/16 overlap */
 
 typedef enum {
     FL2_fast,
@@ -506,6 +582,7 @@ typedef enum {
                              * Typically provides a poor speed/ratio tradeoff. */
     FL2_p_dictionaryLog,    /* Maximum allowed back-reference distance, expressed as power of 2.
                              * Must be clamped between FL2_DICTLOG_MIN and FL2_DICTLOG_MAX.
+                             * A value of 32 selects FL2_DICTSIZE_MAX.
                              * Default = 24 */
     FL2_p_dictionarySize,   /* Same as above but expressed as an absolute value. 
                              * Must be clamped between FL2_DICTSIZE_MIN and FL2_DICTSIZE_MAX.
@@ -564,8 +641,82 @@ typedef enum {
                              * 0 = do not calculate; 1 = calculate (default) */
 #endif
 #ifdef RMF_REFERENCE
-    FL2_p_useReferenceMF    /* Use the reference matchfinder for development purposes. SLOW. */
+    FL2_p_useReferenceMF,   /* Use the reference matchfinder for development purposes. SLOW. */
 #endif
+    /* Parameters added after the original set. Their values follow on from it in every build
+     * configuration so that the values of existing parameters never change. */
+    FL2_p_reuseOverlap = 19, /* Use the match table of each block to exclude positions in the overlap
+                             * retained for the next block which can never be the nearest full-depth match.
+                             * Those positions are not sorted or searched again, which reduces match finder
+                             * work when the overlap fraction is large. Compression is nearly identical.
+                             * Default = disabled */
+    FL2_p_largePages,       /* Allocate the match table and stream dictionary buffers with large pages, which
+                             * reduces TLB misses with large dictionaries. The table is pre-faulted by all
+                             * threads when allocated. 0 = normal pages; 1 = 2 Mb pages; 2 = 1 Gb pages
+                             * where available, otherwise 2 Mb. Falls back to transparent huge pages or
+                             * normal pages if the system has none reserved.
+                             * Default = 0 */
+    FL2_p_numaPolicy,       /* Place the match table, match finder builders and encoders on NUMA nodes, and
+                             * pin the thread running each job to the node of its data. The table is
+                             * interleaved over all nodes. 0 = disabled; 1 = use the system's nodes; n > 1 =
+                             * simulate n nodes by dividing the CPUs, which pins threads but doesn't move
+                             * memory. The calling thread isn't pinned. Linux only.
+                             * Default = 0 */
+    FL2_p_prefetchDistance, /* Number of list entries the match finder reads ahead of the one it is sorting,
+                             * prefetching the data each one points to. 0 = no read-ahead.
+                             * Must be clamped between 0 and FL2_PREFETCH_DISTANCE_MAX.
+                             * Default = FL2_PREFETCH_DISTANCE_DEFAULT */
+    FL2_p_matchAnalysis,    /* Parse each block again with the reference match finder and compare the matches.
+                             * Results are read with FL2_getCCtxMatchQuality(). SLOW, and needs 5 bytes per
+                             * block byte of extra memory. Compression fails with memory_allocation if that
+                             * memory is not available. 0 = disabled (default); 1 = enabled */
+    FL2_p_radix24,          /* In blocks of 64 Mb or more, sort the most frequent 2-byte prefixes by a third byte
+                             * when initializing the match table, which saves the match finder a pass over
+                             * the longest lists. The table can differ slightly in which of the equal length
+                             * matches are found. 0 = disabled (default); 1 = enabled */
+    FL2_p_bufferCeiling,    /* Resize the match buffer of each thread between blocks to fit the lists found, up to
+                             * this many Mb per thread. Starts from the size set by FL2_p_bufferResize.
+                             * 0 = fixed size (default) */
+    FL2_p_adaptiveDepth,    /* Adapt the search depth of each block to the matches found in the previous block,
+                             * between this value and FL2_p_searchDepth. The depth is lowered where deeper
+                             * matches are rarely needed, and raised again where they are.
+                             * 0 = disabled (default); otherwise the minimum depth, at least FL2_SEARCH_DEPTH_MIN */
+    FL2_p_separateOutput,   /* Encode into a buffer for each thread instead of into the match table, which stays
+                             * intact after encoding. Needs about one compressed block of extra memory. Always
+                             * on while encoder variants are set with FL2_setCCtxEncoderVariants().
+                             * 0 = disabled (default); 1 = enabled */
+    FL2_p_suffixArray,      /* Build the match table from a suffix array of each block instead of the radix match
+                             * finder. Matches are exact to the search depth on any input, where the radix match
+                             * finder takes shortcuts on very long lists. SLOWER: the sort runs in one thread, and
+                             * needs 12 bytes per dictionary byte of extra memory. Blocks over 2 Gb use the radix
+                             * match finder.
+                             * 0 = disabled (default); 1 = enabled */
+    FL2_p_smallInput,       /* FL2_compressCCtx() builds the match table from hash chains sized to the input
+                             * when the input is no larger than this many bytes, which skips the setup of
+                             * the radix match finder's list heads in a new context. Compression can be
+                             * a few percent lower. 0 = never (default). Must be clamped between 0 and
+                             * FL2_SMALL_INPUT_MAX. */
+    FL2_p_sliceSize,        /* Minimum number of bytes of a block encoded by each thread. Each thread's slice
+                             * starts with an encoder state reset, so smaller slices let more threads work
+                             * on small blocks for lower latency, at a small cost in compression.
+                             * Must be clamped between FL2_SLICE_SIZE_MIN and FL2_SLICE_SIZE_MAX.
+                             * Default = FL2_SLICE_SIZE_DEFAULT */
+    FL2_p_linkRepeats,      /* Link each position of a repeat of period 8 or less and at least 128 bytes long to
+                             * the same position one period back when initializing the match table, and keep
+                             * those positions out of the radix lists. Much faster on zero-filled and periodic
+                             * data, but any longer match from elsewhere at those positions is lost, which can
+                             * cost up to 1% of compression on binary data.
+                             * 0 = disabled (default); 1 = enabled */
+    FL2_p_workBudget,       /* Give each radix list and each block of the ultra strategy's hash chain search a
+                             * budget of work per position, and cut the search short beyond it. This bounds the
+                             * time per byte on pathological data, but long lists of ordinary repetitive text
+                             * also reach it, which can cost from 0.2% to 10% of compression on such data.
+                             * 0 = disabled (default); 1 = enabled */
+    FL2_p_costModel,        /* Choose the recursion path and brute force limit of each list of 1024 positions
+                             * or more with a cost model which learns the work each path takes on the current
+                             * frame, instead of the fixed limits. Faster on repetitive data at high depth,
+                             * but the table can differ slightly in which of the equal length matches are
+                             * found. 0 = disabled (default); 1 = enabled */
 } FL2_cParameter;
 
 
@@ -599,6 +750,28 @@ FL2LIB_API size_t FL2LIB_CALL FL2_CStream_getParameter(FL2_CStream* fcs, FL2_cPa
  *            (which can be tested with FL2_isError()) if compressionLevel is invalid. */
 FL2LIB_API size_t FL2LIB_CALL FL2_getLevelParameters(int compressionLevel, int high, FL2_compressionParameters *params);
 
+/*! FL2_setCCtxEncoderVariants() :
+ *  Encode each block with the current encoder parameters and again with each variant, all from one
+ *  match table build, and keep the smallest result for each thread's slice of the block. Each slice
+ *  carries its own properties, so the stream remains standard LZMA2. Each variant adds about the
+ *  time of one encoding, and a second compressed block of memory is needed. A count of 0 removes
+ *  all variants. Variants apply to the next frame and can't be changed during one.
+ *  @result : 0, or an error code (which can be tested with FL2_isError()) if count exceeds
+ *            FL2_ENCODER_VARIANTS_MAX or a value is out of bounds. */
+typedef struct {
+    FL2_strategy strategy;
+    unsigned literalCtxBits;  /* lc */
+    unsigned literalPosBits;  /* lp */
+    unsigned posBits;         /* pb */
+    unsigned fastLength;
+    unsigned hybridCycles;    /* ultra strategy only */
+    unsigned hybridChainLog;  /* ultra strategy only */
+} FL2_encoderParameters;
+
+#define FL2_ENCODER_VARIANTS_MAX 4
+
+FL2LIB_API size_t FL2LIB_CALL FL2_setCCtxEncoderVariants(FL2_CCtx* cctx, const FL2_encoderParameters* variants, unsigned count);
+
 
 /***************************************
 *  Context memory usage
@@ -0,0 +1,190 @@
+/*
+* Copyright (c) 2019, Conor McCarthy
+* All rights reserved.
+*
+* This source code is licensed under both the BSD-style license (found in the
+* LICENSE file in the root directory of this source tree) and the GPLv2 (found
+* in the COPYING file in the root directory of this source tree).
+* You may select, at your option, one of the above-listed licenses.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "fl2_alloc.h"
+#include "fl2_internal.h"
+
+#if defined(_WIN32)
+#  ifndef WIN32_LEAN_AND_MEAN
+#    define WIN32_LEAN_AND_MEAN
+#  endif
+#  include <windows.h>
+#  define FL2_ALLOC_VIRTUAL
+#elif defined(__unix__) || defined(__unix) || (defined(__APPLE__) && defined(__MACH__))
+#  include <sys/mman.h>
+#  if defined(MAP_ANONYMOUS) || defined(MAP_ANON)
+#    ifndef MAP_ANONYMOUS
+#      define MAP_ANONYMOUS MAP_ANON
+#    endif
+#    define FL2_ALLOC_MMAP
+#  endif
+#endif
+
+#define ALLOC_HEADER_SIZE 64U /* keeps the caller's buffer cache line aligned */
+#define PREFAULT_STRIDE 4096U /* smallest page size on common systems */
+#define LARGE_PAGE_SIZE ((size_t)1 << 21)
+#define HUGE_PAGE_SIZE ((size_t)1 << 30)
+
+#define ALLOC_TYPE_MALLOC 0U
+#define ALLOC_TYPE_MAP 1U
+
+typedef struct {
+    void* base;       /* start of the allocation */
+    size_t map_size;  /* size of the mapping, if mapped */
+    size_t page_size; /* large page size, or 0 */
+    unsigned type;
+} FL2_allocHeader;
+
+static size_t FL2_roundUp(size_t const size, size_t const page_size)
+{
+    return (size + page_size - 1) & ~(page_size - 1);
+}
+
+#ifdef FL2_ALLOC_MMAP
+
+static void* FL2_mapPages(size_t const size, int const flags)
+{
+    void* const ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+    return (ptr == MAP_FAILED) ? NULL : ptr;
+}
+
+/* Map normal pages aligned to the large page size so that transparent huge pages can back them */
+static void* FL2_mapAligned(size_t const size, size_t const align)
+{
+    BYTE* const ptr = FL2_mapPages(size + align, 0);
+    if (ptr == NULL)
+        return NULL;
+    BYTE* const base = (BYTE*)FL2_roundUp((size_t)ptr, align);
+    if (base != ptr)
+        munmap(ptr, base - ptr);
+    munmap(base + size, (ptr + align) - base);
+    return base;
+}
+
+static void FL2_mapLarge(FL2_allocHeader* const header, size_t const size, unsigned const mode)
+{
+    header->base = NULL;
+#ifdef MAP_HUGETLB
+#  ifdef MAP_HUGE_SHIFT
+    if (mode >= FL2_PAGES_HUGE) {
+        header->map_size = FL2_roundUp(size, HUGE_PAGE_SIZE);
+        header->page_size = HUGE_PAGE_SIZE;
+        header->base = FL2_mapPages(header->map_size, MAP_HUGETLB | (30 << MAP_HUGE_SHIFT));
+    }
+#  endif
+    if (header->base == NULL) {
+        header->map_size = FL2_roundUp(size, LARGE_PAGE_SIZE);
+        header->page_size = LARGE_PAGE_SIZE;
+        header->base = FL2_mapPages(header->map_size, MAP_HUGETLB);
+    }
+#else
+    (void)mode;
+#endif
+    if (header->base == NULL) {
+        header->map_size = FL2_roundUp(size, LARGE_PAGE_SIZE);
+        header->page_size = 0;
+        header->base = FL2_mapAligned(header->map_size, LARGE_PAGE_SIZE);
+#ifdef MADV_HUGEPAGE
+        if (header->base != NULL && madvise(header->base, header->map_size, MADV_HUGEPAGE) == 0)
+            header->page_size = LARGE_PAGE_SIZE;
+#endif
+    }
+    DEBUGLOG(4, "FL2_largeAlloc : %u bytes, page size %u", (unsigned)header->map_size, (unsigned)header->page_size);
+}
+
+#elif defined(FL2_ALLOC_VIRTUAL)
+
+static void FL2_mapLarge(FL2_allocHeader* const header, size_t const size, unsigned const mode)
+{
+    /* Requires SeLockMemoryPrivilege. Windows doesn't select 1 GiB pages through this interface. */
+    size_t const large_page = GetLargePageMinimum();
+    (void)mode;
+    header->base = NULL;
+    if (large_page != 0) {
+        header->map_size = FL2_roundUp(size, large_page);
+        header->page_size = large_page;
+        header->base = VirtualAlloc(NULL, header->map_size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+    }
+    if (header->base == NULL) {
+        header->map_size = size;
+        header->page_size = 0;
+        header->base = VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    }
+}
+
+#endif
+
+void* FL2_largeAlloc(size_t const size, unsigned const mode)
+{
+    FL2_allocHeader header;
+    size_t const total = size + ALLOC_HEADER_SIZE;
+    if (total < size)
+        return NULL;
+
+    header.base = NULL;
+#if defined(FL2_ALLOC_MMAP) || defined(FL2_ALLOC_VIRTUAL)
+    if (mode != FL2_PAGES_NORMAL) {
+        FL2_mapLarge(&header, total, mode);
+        header.type = ALLOC_TYPE_MAP;
+    }
+#endif
+    if (header.base == NULL) {
+        header.base = malloc(total);
+        if (header.base == NULL)
+            return NULL;
+        header.map_size = total;
+        header.page_size = 0;
+        header.type = ALLOC_TYPE_MALLOC;
+    }
+    memcpy(header.base, &header, sizeof(header));
+    return (BYTE*)header.base + ALLOC_HEADER_SIZE;
+}
+
+void FL2_largeFree(void* const ptr)
+{
+    if (ptr == NULL)
+        return;
+    FL2_allocHeader header;
+    memcpy(&header, (BYTE*)ptr - ALLOC_HEADER_SIZE, sizeof(header));
+#if defined(FL2_ALLOC_MMAP)
+    if (header.type == ALLOC_TYPE_MAP) {
+        munmap(header.base, header.map_size);
+        return;
+    }
+#elif defined(FL2_ALLOC_VIRTUAL)
+    if (header.type == ALLOC_TYPE_MAP) {
+        VirtualFree(header.base, 0, MEM_RELEASE);
+        return;
+    }
+#endif
+    free(header.base);
+}
+
+size_t FL2_largePageSize(const void* const ptr)
+{
+    if (ptr == NULL)
+        return 0;
+    FL2_allocHeader header;
+    memcpy(&header, (const BYTE*)ptr - ALLOC_HEADER_SIZE, sizeof(header));
+    return header.page_size;
+}
+
+void FL2_prefault(void* const ptr, size_t const size, size_t const job, size_t const job_count)
+{
+    size_t const slice = FL2_roundUp(size / job_count + 1, PREFAULT_STRIDE);
+    size_t const start = MIN(slice * job, size);
+    size_t const end = MIN(start + slice, size);
+    volatile BYTE* const buf = (volatile BYTE*)ptr;
+
+    for (size_t pos = start; pos < end; pos += PREFAULT_STRIDE)
+        buf[pos] = 0;
+}
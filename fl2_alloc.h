@@ -0,0 +1,50 @@
+/*
+* Copyright (c) 2019, Conor McCarthy
+* All rights reserved.
+*
+* This source code is licensed under both the BSD-style license (found in the
+* LICENSE file in the root directory of this source tree) and the GPLv2 (found
+* in the COPYING file in the root directory of this source tree).
+* You may select, at your option, one of the above-listed licenses.
+*/
+
+#ifndef FL2_ALLOC_H
+#define FL2_ALLOC_H
+
+#include <stddef.h>   /* size_t */
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+/* Large page modes, as set by FL2_p_largePages */
+#define FL2_PAGES_NORMAL 0U
+#define FL2_PAGES_LARGE 1U  /* 2 MiB pages, or the system's large page size */
+#define FL2_PAGES_HUGE 2U   /* 1 GiB pages where available, falling back to FL2_PAGES_LARGE */
+
+/*! FL2_largeAlloc() :
+ *  Allocate a big buffer. Large pages are requested if mode != FL2_PAGES_NORMAL. If the system
+ *  can't supply them, the buffer is allocated with normal pages, aligned for transparent huge
+ *  pages where supported. The buffer must be freed with FL2_largeFree().
+ *  @return : the buffer, or NULL on failure */
+void* FL2_largeAlloc(size_t const size, unsigned const mode);
+
+void FL2_largeFree(void* const ptr);
+
+/*! FL2_largePageSize() :
+ *  @return : the large page size backing the buffer, or 0 for normal pages.
+ *  Transparent huge pages are reported if they were requested, because their use can't be
+ *  confirmed. */
+size_t FL2_largePageSize(const void* const ptr);
+
+/*! FL2_prefault() :
+ *  Touch every page in one of job_count equal slices of a buffer so that the fault cost is paid
+ *  up front, and in parallel if the slices are handled by separate threads. The contents of the
+ *  buffer are overwritten. */
+void FL2_prefault(void* const ptr, size_t const size, size_t const job, size_t const job_count);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif /* FL2_ALLOC_H */
@@ -154,6 +154,7 @@ static FL2_CCtx* FL2_createCCtx_internal(unsigned nbThreads, int const dualBuffe
 #endif
 
     cctx->matchTable = NULL;
+    FL2_numaInit(&cctx->numa, 0);
 
 #ifndef FL2_SINGLETHREAD
     cctx->compressThread = NULL;
@@ -182,6 +183,9 @@ static FL2_CCtx* FL2_createCCtx_internal(unsigned nbThreads, int const dualBuffe
 
     FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, FL2_CLEVEL_DEFAULT);
     cctx->params.cParams.reset_interval = 4;
+    cctx->params.rParams.prefetch_distance = FL2_PREFETCH_DISTANCE_DEFAULT;
+    cctx->params.smallInput = FL2_SMALL_INPUT_DEFAULT;
+    cctx->params.sliceSize = FL2_SLICE_SIZE_DEFAULT;
 
     return cctx;
 }
@@ -207,6 +211,8 @@ FL2LIB_API void FL2LIB_CALL FL2_freeCCtx(FL2_CCtx* cctx)
 
     for (unsigned u = 0; u < cctx->jobCount; ++u) {
         LZMA2_freeECtx(cctx->jobs[u].enc);
+        free(cctx->jobs[u].outBuf);
+        free(cctx->jobs[u].spareBuf);
     }
 
 #ifndef FL2_SINGLETHREAD
@@ -223,26 +229,280 @@ FL2LIB_API unsigned FL2LIB_CALL FL2_getCCtxThreadCount(const FL2_CCtx* cctx)
     return cctx->jobCount;
 }
 
+FL2LIB_API size_t FL2LIB_CALL FL2_getCCtxBuilderStats(const FL2_CCtx* cctx, unsigned thread, FL2_builderStats* stats)
+{
+    if (cctx->matchTable == NULL)
+        return FL2_ERROR(stage_wrong);
+    CHECK_F(RMF_getBuilderStats(cctx->matchTable, thread, stats));
+    stats->degradedSearches = LZMA2_degradedSearches(cctx->jobs[thread].enc);
+    return 0;
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_getCCtxMatchQuality(const FL2_CCtx* cctx, FL2_matchQuality* quality)
+{
+    if (cctx->matchTable == NULL)
+        return FL2_ERROR(stage_wrong);
+    RMF_getMatchQuality(cctx->matchTable, quality);
+    return 0;
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_getCCtxLargePageSize(const FL2_CCtx* cctx)
+{
+    if (cctx->matchTable == NULL)
+        return 0;
+    return RMF_largePageSize(cctx->matchTable);
+}
+
+/* FL2_pinJob() :
+ * Pin a pool thread to the node of job n. Pool threads take whichever job is next, so this is
+ * done for every job. Without placement a thread pinned under an earlier policy is unpinned.
+ * Job 0 runs on the caller's thread, which is left alone. */
+static void FL2_pinJob(const FL2_CCtx* const cctx, ptrdiff_t const n)
+{
+    if (n == 0)
+        return;
+    if (cctx->numa.node_count > 1)
+        FL2_numaPinThread(&cctx->numa, FL2_numaJobNode(&cctx->numa, n, cctx->jobCount));
+    else
+        FL2_numaUnpinThread();
+}
+
+/* FL2_numaPlaceBuffers() :
+ * Apply the NUMA policy to the match table, builders and encoders. The table and builders are
+ * placed once when created; encoder hash chains can be reallocated at any frame. */
+static void FL2_numaPlaceBuffers(FL2_CCtx* const cctx)
+{
+    if (cctx->numa.policy != cctx->params.numaPolicy) {
+        FL2_numaInit(&cctx->numa, cctx->params.numaPolicy);
+        cctx->numaPlaced = 0;
+    }
+    if (cctx->numa.node_count < 2)
+        return;
+    if (!cctx->numaPlaced) {
+        RMF_numaPlace(cctx->matchTable, &cctx->numa);
+        cctx->numaPlaced = 1;
+    }
+    for (unsigned u = 0; u < cctx->jobCount; ++u)
+        LZMA2_numaPlace(cctx->jobs[u].enc, &cctx->numa, FL2_numaJobNode(&cctx->numa, u, cctx->jobCount));
+}
+
+/* FL2_prefaultJob() : FL2POOL_function type */
+static void FL2_prefaultJob(void* const jobDescription, ptrdiff_t const n)
+{
+    FL2_CCtx* const cctx = (FL2_CCtx*)jobDescription;
+
+    FL2_pinJob(cctx, n);
+
+    if (cctx->prefaultTable)
+        RMF_prefaultTable(cctx->matchTable, n, cctx->jobCount);
+    if (cctx->prefaultDict)
+        DICT_prefault(&cctx->buf, n, cctx->jobCount);
+}
+
+/* FL2_prefaultBuffers() :
+ * Fault in newly allocated large page buffers on all threads */
+static void FL2_prefaultBuffers(FL2_CCtx* const cctx)
+{
+    if (!cctx->prefaultTable && !cctx->prefaultDict)
+        return;
+#ifndef FL2_SINGLETHREAD
+    FL2POOL_addRange(cctx->factory, FL2_prefaultJob, cctx, 1, cctx->jobCount);
+#endif
+    FL2_prefaultJob(cctx, 0);
+#ifndef FL2_SINGLETHREAD
+    FL2POOL_waitAll(cctx->factory, 0);
+#endif
+    cctx->prefaultTable = 0;
+    cctx->prefaultDict = 0;
+}
+
+#ifndef FL2_SINGLETHREAD
+
+/* FL2_initRadixSegment() : FL2POOL_function type */
+static void FL2_initRadixSegment(void* const jobDescription, ptrdiff_t const n)
+{
+    FL2_CCtx* const cctx = (FL2_CCtx*)jobDescription;
+
+    FL2_pinJob(cctx, n);
+    RMF_initTableSegment(cctx->matchTable, cctx->curBlock.data, cctx->curBlock.end, n);
+}
+
+/* FL2_mergeRadixSegments() : FL2POOL_function type */
+static void FL2_mergeRadixSegments(void* const jobDescription, ptrdiff_t const n)
+{
+    FL2_CCtx* const cctx = (FL2_CCtx*)jobDescription;
+
+    FL2_pinJob(cctx, n);
+    RMF_mergeTableSegments(cctx->matchTable, n);
+}
+
+#endif
+
+/* FL2_initRadixTable() :
+ * Initialize the match table for cctx->curBlock, splitting the work across
+ * the thread pool when the block is large enough. */
+static void FL2_initRadixTable(FL2_CCtx* const cctx, size_t const mfThreads)
+{
+    RMF_setBlockDepth(cctx->matchTable);
+    RMF_prepareOverlapReuse(cctx->matchTable, cctx->curBlock.start);
+#ifndef FL2_SINGLETHREAD
+    size_t const segments = RMF_initSegmentCount(cctx->matchTable, cctx->curBlock.data, cctx->curBlock.end, mfThreads);
+    if (segments > 1) {
+        FL2POOL_addRange(cctx->factory, FL2_initRadixSegment, cctx, 1, segments);
+        FL2_initRadixSegment(cctx, 0);
+        FL2POOL_waitAll(cctx->factory, 0);
+
+        FL2POOL_addRange(cctx->factory, FL2_mergeRadixSegments, cctx, 1, segments);
+        FL2_mergeRadixSegments(cctx, 0);
+        FL2POOL_waitAll(cctx->factory, 0);
+
+        RMF_finishTableSegments(cctx->matchTable, cctx->curBlock.data, cctx->curBlock.end);
+        return;
+    }
+#else
+    (void)mfThreads;
+#endif
+    RMF_initTable(cctx->matchTable, cctx->curBlock.data, cctx->curBlock.end);
+}
+
 /* FL2_buildRadixTable() : FL2POOL_function type */
 static void FL2_buildRadixTable(void* const jobDescription, ptrdiff_t const n)
 {
     FL2_CCtx* const cctx = (FL2_CCtx*)jobDescription;
 
+    FL2_pinJob(cctx, n);
     RMF_buildTable(cctx->matchTable, n, 1, cctx->curBlock);
 }
 
+/* FL2_jobOutput() :
+ * The compressed output of job n, which is in the match table unless the table is kept intact.
+ */
+static BYTE* FL2_jobOutput(FL2_CCtx* const cctx, size_t const n)
+{
+    if (cctx->separateOut && cctx->jobs[n].outBuf != NULL)
+        return cctx->jobs[n].outBuf;
+    return RMF_getTableAsOutputBuffer(cctx->matchTable, cctx->jobs[n].block.start);
+}
+
 /* FL2_compressRadixChunk() : FL2POOL_function type */
 static void FL2_compressRadixChunk(void* const jobDescription, ptrdiff_t const n)
 {
     FL2_CCtx* const cctx = (FL2_CCtx*)jobDescription;
 
+    FL2_pinJob(cctx, n);
     cctx->jobs[n].cSize = LZMA2_encode(cctx->jobs[n].enc, cctx->matchTable,
         cctx->jobs[n].block,
-        &cctx->params.cParams,
+        cctx->separateOut ? cctx->jobs[n].outBuf : NULL,
+        cctx->encParams,
         -1,
         &cctx->progressIn, &cctx->progressOut, &cctx->canceled);
 }
 
+/* FL2_allocOutput() :
+ * Ensure each job has an output buffer large enough for its slice, plus a spare if there are
+ * encoder variants.
+ */
+static size_t FL2_allocOutput(FL2_CCtx* const cctx, size_t const nbThreads)
+{
+    for (size_t u = 0; u < nbThreads; ++u) {
+        FL2_job* const job = cctx->jobs + u;
+        size_t const capacity = LZMA2_encodeBound(job->block.end - job->block.start) + 6; /* property byte, end marker and hash */
+        if (job->outCapacity < capacity) {
+            free(job->outBuf);
+            free(job->spareBuf);
+            job->spareBuf = NULL;
+            job->outCapacity = 0;
+            job->outBuf = malloc(capacity);
+            if (job->outBuf == NULL)
+                return FL2_ERROR(memory_allocation);
+            job->outCapacity = capacity;
+        }
+        if (cctx->variantCount != 0 && job->spareBuf == NULL) {
+            job->spareBuf = malloc(job->outCapacity);
+            if (job->spareBuf == NULL)
+                return FL2_ERROR(memory_allocation);
+        }
+    }
+    return FL2_error_no_error;
+}
+
+/* FL2_encodeSlices() :
+ * Encode the slice of each job with params.
+ */
+static void FL2_encodeSlices(FL2_CCtx* const cctx, const FL2_lzma2Parameters* const params, size_t const nbThreads, int const streamProp)
+{
+    cctx->encParams = params;
+
+#ifndef FL2_SINGLETHREAD
+    FL2POOL_addRange(cctx->factory, FL2_compressRadixChunk, cctx, 1, nbThreads);
+#else
+    (void)nbThreads;
+#endif
+
+    cctx->jobs[0].cSize = LZMA2_encode(cctx->jobs[0].enc, cctx->matchTable,
+        cctx->jobs[0].block,
+        cctx->separateOut ? cctx->jobs[0].outBuf : NULL,
+        params, streamProp,
+        &cctx->progressIn, &cctx->progressOut, &cctx->canceled);
+
+#ifndef FL2_SINGLETHREAD
+    FL2POOL_waitAll(cctx->factory, 0);
+#endif
+}
+
+/* FL2_encodeBlock() :
+ * Encode the slices with the current parameters, then again with each variant. The smallest
+ * output of each slice is kept. The table must be intact for the variants.
+ */
+static void FL2_encodeBlock(FL2_CCtx* const cctx, size_t const nbThreads, int const streamProp)
+{
+    FL2_encodeSlices(cctx, &cctx->params.cParams, nbThreads, streamProp);
+
+    for (unsigned v = 0; v < cctx->variantCount; ++v) {
+        size_t best[FL2_MAXTHREADS];
+        for (size_t u = 0; u < nbThreads; ++u) {
+            FL2_job* const job = cctx->jobs + u;
+            if (FL2_isError(job->cSize))
+                return;
+            BYTE* const buf = job->outBuf;
+            job->outBuf = job->spareBuf;
+            job->spareBuf = buf;
+            best[u] = job->cSize;
+        }
+        cctx->progressIn = 0;
+        cctx->progressOut = 0;
+
+        /* Apply the variant over the current parameters, which may have changed since it was set */
+        const FL2_encoderParameters* const variant = cctx->variants + v;
+        FL2_lzma2Parameters params = cctx->params.cParams;
+        params.strategy = variant->strategy;
+        params.lc = variant->literalCtxBits;
+        params.lp = variant->literalPosBits;
+        params.pb = variant->posBits;
+        params.fast_length = variant->fastLength;
+        params.match_cycles = variant->hybridCycles;
+        params.second_dict_bits = variant->hybridChainLog;
+
+        FL2_encodeSlices(cctx, &params, nbThreads, streamProp);
+
+        size_t total = 0;
+        for (size_t u = 0; u < nbThreads; ++u) {
+            FL2_job* const job = cctx->jobs + u;
+            if (cctx->canceled)
+                return;
+            /* Keep the earlier output unless the variant is smaller */
+            if (FL2_isError(job->cSize) || job->cSize >= best[u]) {
+                BYTE* const buf = job->outBuf;
+                job->outBuf = job->spareBuf;
+                job->spareBuf = buf;
+                job->cSize = best[u];
+            }
+            total += job->cSize;
+        }
+        cctx->progressOut = (long long)total;
+    }
+}
+
 static int FL2_initEncoders(FL2_CCtx* const cctx)
 {
     for(unsigned u = 0; u < cctx->jobCount; ++u) {
@@ -261,6 +521,45 @@ static void FL2_initProgress(FL2_CCtx* const cctx)
     cctx->canceled = 0;
 }
 
+/* FL2_buildMatchTable() :
+ * Build the match table for cctx->curBlock from hash chains for a small input, or from a suffix
+ * array if selected, otherwise with the radix match finder in up to mfThreads threads.
+ */
+static size_t FL2_buildMatchTable(FL2_CCtx* const cctx, size_t const mfThreads)
+{
+    if (cctx->chainBuild && RMF_buildChainTable(cctx->matchTable, cctx->curBlock) == 0)
+        return FL2_error_no_error;
+
+    if (cctx->params.rParams.suffix_array && RMF_buildSuffixTable(cctx->matchTable, cctx->curBlock) == 0)
+        return FL2_error_no_error;
+
+    /* initialize to length 2 */
+    FL2_initRadixTable(cctx, mfThreads);
+
+    if (cctx->canceled) {
+        RMF_resetIncompleteBuild(cctx->matchTable);
+        return FL2_ERROR(canceled);
+    }
+
+#ifndef FL2_SINGLETHREAD
+    if (mfThreads > 1)
+        RMF_initSchedule(cctx->matchTable, mfThreads);
+    FL2POOL_addRange(cctx->factory, FL2_buildRadixTable, cctx, 1, mfThreads);
+#endif
+
+    int const err = RMF_buildTable(cctx->matchTable, 0, mfThreads > 1, cctx->curBlock);
+
+#ifndef FL2_SINGLETHREAD
+    FL2POOL_waitAll(cctx->factory, 0);
+#endif
+
+    if (err)
+        return FL2_ERROR(canceled);
+
+    RMF_accumulateStats(cctx->matchTable, mfThreads);
+    return FL2_error_no_error;
+}
+
 /* FL2_compressCurBlock_blocking() :
  * Compress cctx->curBlock and wait until complete.
  * Write streamProp as the first byte if >= 0
@@ -270,7 +569,7 @@ static size_t FL2_compressCurBlock_blocking(FL2_CCtx* const cctx, int const stre
     size_t const encodeSize = (cctx->curBlock.end - cctx->curBlock.start);
 #ifndef FL2_SINGLETHREAD
     size_t mfThreads = cctx->curBlock.end / RMF_MIN_BYTES_PER_THREAD;
-    size_t nbThreads = MIN(cctx->jobCount, encodeSize / ENC_MIN_BYTES_PER_THREAD);
+    size_t nbThreads = MIN(cctx->jobCount, encodeSize / cctx->params.sliceSize);
     nbThreads += !nbThreads;
 #else
     size_t mfThreads = 1;
@@ -293,61 +592,26 @@ static size_t FL2_compressCurBlock_blocking(FL2_CCtx* const cctx, int const stre
     }
     cctx->jobs[nbThreads - 1].block.end = cctx->curBlock.end;
 
-    /* initialize to length 2 */
-    RMF_initTable(cctx->matchTable, cctx->curBlock.data, cctx->curBlock.end);
-
-    if (cctx->canceled) {
-        RMF_resetIncompleteBuild(cctx->matchTable);
-        return FL2_ERROR(canceled);
-    }
-
 #ifndef FL2_SINGLETHREAD
-
     mfThreads = MIN(RMF_threadCount(cctx->matchTable), mfThreads);
-    FL2POOL_addRange(cctx->factory, FL2_buildRadixTable, cctx, 1, mfThreads);
-
-#endif
-
-    int err = RMF_buildTable(cctx->matchTable, 0, mfThreads > 1, cctx->curBlock);
-
-#ifndef FL2_SINGLETHREAD
-
-    FL2POOL_waitAll(cctx->factory, 0);
-
-    if (err)
-        return FL2_ERROR(canceled);
-
-#ifdef RMF_CHECK_INTEGRITY
-    err = RMF_integrityCheck(cctx->matchTable, cctx->curBlock.data, cctx->curBlock.start, cctx->curBlock.end, cctx->params.rParams.depth);
-    if (err)
-        return FL2_ERROR(internal);
 #endif
 
-    FL2POOL_addRange(cctx->factory, FL2_compressRadixChunk, cctx, 1, nbThreads);
-
-    cctx->jobs[0].cSize = LZMA2_encode(cctx->jobs[0].enc, cctx->matchTable,
-        cctx->jobs[0].block,
-        &cctx->params.cParams, streamProp,
-        &cctx->progressIn, &cctx->progressOut, &cctx->canceled);
-
-    FL2POOL_waitAll(cctx->factory, 0);
+    if (cctx->separateOut)
+        CHECK_F(FL2_allocOutput(cctx, nbThreads));
 
-#else /* FL2_SINGLETHREAD */
+    CHECK_F(FL2_buildMatchTable(cctx, mfThreads));
 
-    if (err)
-        return FL2_ERROR(canceled);
+    CHECK_F(RMF_analyzeMatches(cctx->matchTable, cctx->curBlock));
+    RMF_adaptDepth(cctx->matchTable, cctx->curBlock);
+    RMF_markOverlapReuse(cctx->matchTable, cctx->curBlock, OVERLAP_FROM_DICT_SIZE(cctx->params.rParams.dictionary_size, cctx->params.rParams.overlap_fraction));
 
 #ifdef RMF_CHECK_INTEGRITY
-    err = RMF_integrityCheck(cctx->matchTable, cctx->curBlock.data, cctx->curBlock.start, cctx->curBlock.end, cctx->params.rParams.depth);
+    int const err = RMF_integrityCheck(cctx->matchTable, cctx->curBlock.data, cctx->curBlock.start, cctx->curBlock.end, cctx->params.rParams.depth);
     if (err)
         return FL2_ERROR(internal);
 #endif
-    cctx->jobs[0].cSize = LZMA2_encode(cctx->jobs[0].enc, cctx->matchTable,
-        cctx->jobs[0].block,
-        &cctx->params.cParams, streamProp,
-        &cctx->progressIn, &cctx->progressOut, &cctx->canceled);
 
-#endif
+    FL2_encodeBlock(cctx, nbThreads, streamProp);
 
     for (size_t u = 0; u < nbThreads; ++u)
         if (FL2_isError(cctx->jobs[u].cSize))
@@ -450,6 +714,8 @@ static size_t FL2_beginFrame(FL2_CCtx* const cctx, size_t const dictReduce)
         cctx->matchTable = RMF_createMatchTable(&cctx->params.rParams, dictReduce, cctx->jobCount);
         if (cctx->matchTable == NULL)
             return FL2_ERROR(memory_allocation);
+        cctx->prefaultTable = cctx->params.rParams.large_pages != 0;
+        cctx->numaPlaced = 0;
     }
     else {
         DEBUGLOG(5, "Have compatible match table");
@@ -462,6 +728,13 @@ static size_t FL2_beginFrame(FL2_CCtx* const cctx, size_t const dictReduce)
     cctx->progressIn = 0;
     cctx->progressOut = 0;
     RMF_initProgress(cctx->matchTable);
+    RMF_resetStats(cctx->matchTable);
+    for (unsigned u = 0; u < cctx->jobCount; ++u)
+        LZMA2_resetStats(cctx->jobs[u].enc);
+    FL2_numaPlaceBuffers(cctx);
+    FL2_prefaultBuffers(cctx);
+    cctx->separateOut = cctx->params.separateOutput || cctx->variantCount != 0;
+    cctx->chainBuild = 0;
     cctx->asyncRes = 0;
     cctx->outThread = 0;
     cctx->threadCount = 0;
@@ -515,7 +788,7 @@ static size_t FL2_compressBuffer(FL2_CCtx* const cctx,
             if (dstCapacity < cctx->jobs[u].cSize) 
                 return FL2_ERROR(dstSize_tooSmall);
 
-            const BYTE* const outBuf = RMF_getTableAsOutputBuffer(cctx->matchTable, cctx->jobs[u].block.start);
+            const BYTE* const outBuf = FL2_jobOutput(cctx, u);
             memcpy(dstBuf, outBuf, cctx->jobs[u].cSize);
 
             dstBuf += cctx->jobs[u].cSize;
@@ -559,6 +832,7 @@ FL2LIB_API size_t FL2LIB_CALL FL2_compressCCtx(FL2_CCtx* cctx,
 
     FL2_preBeginFrame(cctx, srcSize);
     CHECK_F(FL2_beginFrame(cctx, srcSize));
+    cctx->chainBuild = srcSize <= cctx->params.smallInput;
 
     size_t const cSize = FL2_compressBuffer(cctx, src, srcSize, dst, dstCapacity);
 
@@ -660,7 +934,7 @@ FL2LIB_API size_t FL2LIB_CALL FL2_CCtx_setParameter(FL2_CCtx* cctx, FL2_cParamet
 
     case FL2_p_dictionaryLog:
         CLAMPCHECK(value, FL2_DICTLOG_MIN, FL2_DICTLOG_MAX);
-        cctx->params.rParams.dictionary_size = (size_t)1 << value;
+        cctx->params.rParams.dictionary_size = MIN((size_t)1 << value, FL2_DICTSIZE_MAX);
         break;
 
     case FL2_p_dictionarySize:
@@ -745,6 +1019,77 @@ FL2LIB_API size_t FL2LIB_CALL FL2_CCtx_setParameter(FL2_CCtx* cctx, FL2_cParamet
     case FL2_p_omitProperties:
         cctx->params.omitProp = value != 0;
         break;
+
+    case FL2_p_reuseOverlap:
+        cctx->params.rParams.reuse_overlap = value != 0;
+        break;
+
+    case FL2_p_largePages:
+        MAXCHECK(value, FL2_LARGEPAGES_MAX);
+        cctx->params.rParams.large_pages = (unsigned)value;
+        break;
+
+    case FL2_p_numaPolicy:
+        MAXCHECK(value, FL2_NUMAPOLICY_MAX);
+        cctx->params.numaPolicy = (unsigned)value;
+        break;
+
+    case FL2_p_prefetchDistance:
+        MAXCHECK(value, FL2_PREFETCH_DISTANCE_MAX);
+        cctx->params.rParams.prefetch_distance = (unsigned)value;
+        break;
+
+    case FL2_p_matchAnalysis:
+        cctx->params.rParams.match_analysis = value != 0;
+        break;
+
+    case FL2_p_radix24:
+        cctx->params.rParams.radix24 = value != 0;
+        break;
+
+    case FL2_p_bufferCeiling:
+        if (value != 0)
+            CLAMPCHECK(value, FL2_BUFFER_CEILING_MIN, FL2_BUFFER_CEILING_MAX);
+        cctx->params.rParams.buffer_ceiling = (unsigned)value;
+        break;
+
+    case FL2_p_adaptiveDepth:
+        if (value != 0)
+            CLAMPCHECK(value, FL2_SEARCH_DEPTH_MIN, FL2_SEARCH_DEPTH_MAX);
+        cctx->params.rParams.adaptive_depth = (unsigned)value;
+        break;
+
+    case FL2_p_separateOutput:
+        cctx->params.separateOutput = value != 0;
+        break;
+
+    case FL2_p_suffixArray:
+        cctx->params.rParams.suffix_array = value != 0;
+        break;
+
+    case FL2_p_smallInput:
+        MAXCHECK(value, FL2_SMALL_INPUT_MAX);
+        cctx->params.smallInput = value;
+        break;
+
+    case FL2_p_sliceSize:
+        CLAMPCHECK(value, FL2_SLICE_SIZE_MIN, FL2_SLICE_SIZE_MAX);
+        cctx->params.sliceSize = value;
+        break;
+
+    case FL2_p_linkRepeats:
+        cctx->params.rParams.link_runs = value != 0;
+        break;
+
+    case FL2_p_workBudget:
+        cctx->params.rParams.work_budget = value != 0;
+        cctx->params.cParams.work_budget = value != 0;
+        break;
+
+    case FL2_p_costModel:
+        cctx->params.rParams.cost_model = value != 0;
+        break;
+
 #ifdef RMF_REFERENCE
     case FL2_p_useReferenceMF:
         cctx->params.rParams.use_ref_mf = value != 0;
@@ -818,6 +1163,52 @@ FL2LIB_API size_t FL2LIB_CALL FL2_CCtx_getParameter(FL2_CCtx* cctx, FL2_cParamet
 
     case FL2_p_omitProperties:
         return cctx->params.omitProp;
+
+    case FL2_p_reuseOverlap:
+        return cctx->params.rParams.reuse_overlap;
+
+    case FL2_p_largePages:
+        return cctx->params.rParams.large_pages;
+
+    case FL2_p_numaPolicy:
+        return cctx->params.numaPolicy;
+
+    case FL2_p_prefetchDistance:
+        return cctx->params.rParams.prefetch_distance;
+
+    case FL2_p_matchAnalysis:
+        return cctx->params.rParams.match_analysis;
+
+    case FL2_p_radix24:
+        return cctx->params.rParams.radix24;
+
+    case FL2_p_bufferCeiling:
+        return cctx->params.rParams.buffer_ceiling;
+
+    case FL2_p_adaptiveDepth:
+        return cctx->params.rParams.adaptive_depth;
+
+    case FL2_p_separateOutput:
+        return cctx->params.separateOutput;
+
+    case FL2_p_suffixArray:
+        return cctx->params.rParams.suffix_array;
+
+    case FL2_p_smallInput:
+        return cctx->params.smallInput;
+
+    case FL2_p_sliceSize:
+        return cctx->params.sliceSize;
+
+    case FL2_p_linkRepeats:
+        return cctx->params.rParams.link_runs;
+
+    case FL2_p_workBudget:
+        return cctx->params.rParams.work_budget;
+
+    case FL2_p_costModel:
+        return cctx->params.rParams.cost_model;
+
 #ifdef RMF_REFERENCE
     case FL2_p_useReferenceMF:
         return cctx->params.rParams.use_ref_mf;
@@ -866,8 +1257,9 @@ FL2LIB_API size_t FL2LIB_CALL FL2_initCStream(FL2_CStream* fcs, int compressionL
     size_t const dictSize = fcs->params.rParams.dictionary_size;
 
     /* Free unsuitable objects before reallocating anything new */
-    if (DICT_size(buf) < dictSize)
+    if (DICT_size(buf) < dictSize || DICT_largePages(buf) != fcs->params.rParams.large_pages)
         DICT_destruct(buf);
+    fcs->prefaultDict = fcs->params.rParams.large_pages != 0 && DICT_size(buf) == 0;
 
     FL2_preBeginFrame(fcs, 0);
 
@@ -877,7 +1269,7 @@ FL2LIB_API size_t FL2LIB_CALL FL2_initCStream(FL2_CStream* fcs, int compressionL
     int const doHash = (fcs->params.doXXH && !fcs->params.omitProp);
 #endif
     size_t dictOverlap = OVERLAP_FROM_DICT_SIZE(fcs->params.rParams.dictionary_size, fcs->params.rParams.overlap_fraction);
-    if (DICT_init(buf, dictSize, dictOverlap, fcs->params.cParams.reset_interval, doHash) != 0)
+    if (DICT_init(buf, dictSize, dictOverlap, fcs->params.cParams.reset_interval, doHash, fcs->params.rParams.large_pages) != 0)
         return FL2_ERROR(memory_allocation);
 
     CHECK_F(FL2_beginFrame(fcs, 0));
@@ -941,7 +1333,7 @@ static size_t FL2_compressStream_internal(FL2_CStream* const fcs, int const endi
 FL2LIB_API size_t FL2LIB_CALL FL2_copyCStreamOutput(FL2_CStream* fcs, FL2_outBuffer *output)
 {
     for (; fcs->outThread < fcs->threadCount; ++fcs->outThread) {
-        const BYTE* const outBuf = RMF_getTableAsOutputBuffer(fcs->matchTable, fcs->jobs[fcs->outThread].block.start) + fcs->outPos;
+        const BYTE* const outBuf = FL2_jobOutput(fcs, fcs->outThread) + fcs->outPos;
         BYTE* const dstBuf = (BYTE*)output->dst + output->pos;
         size_t const dstCapacity = output->size - output->pos;
         size_t toWrite = fcs->jobs[fcs->outThread].cSize;
@@ -1070,7 +1462,7 @@ FL2LIB_API size_t FL2LIB_CALL FL2_getNextCompressedBuffer(FL2_CStream* fcs, FL2_
 #endif
 
     if (fcs->outThread < fcs->threadCount) {
-        cbuf->src = RMF_getTableAsOutputBuffer(fcs->matchTable, fcs->jobs[fcs->outThread].block.start) + fcs->outPos;
+        cbuf->src = FL2_jobOutput(fcs, fcs->outThread) + fcs->outPos;
         cbuf->size = fcs->jobs[fcs->outThread].cSize - fcs->outPos;
         ++fcs->outThread;
         fcs->outPos = 0;
@@ -1139,8 +1531,7 @@ static void FL2_writeEnd(FL2_CStream* const fcs)
         fcs->jobs[0].cSize = 0;
         thread = 0;
     }
-    BYTE *const dst = RMF_getTableAsOutputBuffer(fcs->matchTable, fcs->jobs[thread].block.start)
-        + fcs->jobs[thread].cSize;
+    BYTE *const dst = FL2_jobOutput(fcs, thread) + fcs->jobs[thread].cSize;
 
     size_t pos = 0;
 
@@ -1253,12 +1644,38 @@ FL2LIB_API size_t FL2LIB_CALL FL2_getLevelParameters(int compressionLevel, int h
     return FL2_error_no_error;
 }
 
-static size_t FL2_memoryUsage_internal(size_t const dictionarySize, unsigned const bufferResize,
+FL2LIB_API size_t FL2LIB_CALL FL2_setCCtxEncoderVariants(FL2_CCtx* cctx, const FL2_encoderParameters* variants, unsigned count)
+{
+    if (cctx->lockParams)
+        return FL2_ERROR(stage_wrong);
+    MAXCHECK(count, FL2_ENCODER_VARIANTS_MAX);
+
+    for (unsigned i = 0; i < count; ++i) {
+        const FL2_encoderParameters* const v = variants + i;
+        MAXCHECK((unsigned)v->strategy, (unsigned)FL2_ultra);
+        MAXCHECK(v->literalCtxBits, FL2_LC_MAX);
+        MAXCHECK(v->literalPosBits, FL2_LP_MAX);
+        MAXCHECK(v->literalCtxBits + v->literalPosBits, FL2_LCLP_MAX);
+        MAXCHECK(v->posBits, FL2_PB_MAX);
+        CLAMPCHECK(v->fastLength, FL2_FASTLENGTH_MIN, FL2_FASTLENGTH_MAX);
+        CLAMPCHECK(v->hybridCycles, FL2_HYBRIDCYCLES_MIN, FL2_HYBRIDCYCLES_MAX);
+        CLAMPCHECK(v->hybridChainLog, FL2_CHAINLOG_MIN, FL2_CHAINLOG_MAX);
+    }
+    if (count != 0)
+        memcpy(cctx->variants, variants, count * sizeof(*variants));
+    cctx->variantCount = count;
+    return FL2_error_no_error;
+}
+
+static size_t FL2_memoryUsage_internal(size_t const dictionarySize, unsigned const searchDepth,
+    unsigned const bufferResize,
+    unsigned const bufferCeiling,
+    unsigned const suffixArray,
     unsigned const chainLog,
     FL2_strategy const strategy,
     unsigned const nbThreads)
 {
-    return RMF_memoryUsage(dictionarySize, bufferResize, nbThreads)
+    return RMF_memoryUsage(dictionarySize, searchDepth, bufferResize, bufferCeiling, suffixArray, nbThreads)
         + LZMA2_encMemoryUsage(chainLog, strategy, nbThreads);
 }
 
@@ -1275,8 +1692,11 @@ FL2LIB_API size_t FL2LIB_CALL FL2_estimateCCtxSize(int compressionLevel, unsigne
 FL2LIB_API size_t FL2LIB_CALL FL2_estimateCCtxSize_byParams(const FL2_compressionParameters * params, unsigned nbThreads)
 {
     nbThreads = FL2_checkNbThreads(nbThreads);
-    return FL2_memoryUsage_internal(params->dictionarySize,
+    return FL2_memoryUsage_internal(MIN(params->dictionarySize, FL2_DICTSIZE_MAX),
+        params->searchDepth,
         FL2_BUFFER_RESIZE_DEFAULT,
+        0,
+        0,
         params->chainLog,
         params->strategy,
         nbThreads);
@@ -1285,10 +1705,16 @@ FL2LIB_API size_t FL2LIB_CALL FL2_estimateCCtxSize_byParams(const FL2_compressio
 FL2LIB_API size_t FL2LIB_CALL FL2_estimateCCtxSize_usingCCtx(const FL2_CCtx * cctx)
 {
     return FL2_memoryUsage_internal(cctx->params.rParams.dictionary_size,
+        cctx->params.rParams.depth,
         cctx->params.rParams.match_buffer_resize,
+        cctx->params.rParams.buffer_ceiling,
+        cctx->params.rParams.suffix_array,
         cctx->params.cParams.second_dict_bits,
         cctx->params.cParams.strategy,
-        cctx->jobCount) + DICT_memUsage(&cctx->buf);
+        cctx->jobCount) + DICT_memUsage(&cctx->buf)
+        /* Output buffers, and the spares for encoder variants */
+        + ((cctx->params.separateOutput || cctx->variantCount != 0)
+            ? LZMA2_encodeBound(cctx->params.rParams.dictionary_size) << (cctx->variantCount != 0) : 0);
 }
 
 FL2LIB_API size_t FL2LIB_CALL FL2_estimateCStreamSize(int compressionLevel, unsigned nbThreads, int dualBuffer)
@@ -1300,7 +1726,7 @@ FL2LIB_API size_t FL2LIB_CALL FL2_estimateCStreamSize(int compressionLevel, unsi
 FL2LIB_API size_t FL2LIB_CALL FL2_estimateCStreamSize_byParams(const FL2_compressionParameters * params, unsigned nbThreads, int dualBuffer)
 {
     return FL2_estimateCCtxSize_byParams(params, nbThreads)
-        + (params->dictionarySize << (dualBuffer != 0));
+        + (MIN(params->dictionarySize, FL2_DICTSIZE_MAX) << (dualBuffer != 0));
 }
 
 FL2LIB_API size_t FL2LIB_CALL FL2_estimateCStreamSize_usingCStream(const FL2_CStream* fcs)
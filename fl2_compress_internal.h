@@ -23,6 +23,7 @@
 #include "fl2_threading.h"
 #include "fl2_pool.h"
 #include "dict_buffer.h"
+#include "fl2_numa.h"
 #ifndef NO_XXHASH
 #  include "xxhash.h"
 #endif
@@ -44,6 +45,10 @@ typedef struct {
     BYTE doXXH;
 #endif
     BYTE omitProp;
+    BYTE separateOutput;
+    unsigned numaPolicy;
+    size_t smallInput;
+    size_t sliceSize;
 } FL2_CCtx_params;
 
 typedef struct {
@@ -51,6 +56,9 @@ typedef struct {
     LZMA2_ECtx* enc;
     FL2_dataBlock block;
     size_t cSize;
+    BYTE* outBuf;   /* output when the table is kept intact */
+    BYTE* spareBuf; /* holds the best output so far while a variant is encoded */
+    size_t outCapacity;
 } FL2_job;
 
 struct FL2_CCtx_s {
@@ -69,18 +77,27 @@ struct FL2_CCtx_s {
     U64 streamTotal;
     U64 streamCsize;
     FL2_matchTable* matchTable;
+    const FL2_lzma2Parameters* encParams; /* parameters for the encoder jobs */
+    FL2_encoderParameters variants[FL2_ENCODER_VARIANTS_MAX]; /* applied over cParams for each block */
+    unsigned variantCount;
+    BYTE separateOut;   /* output goes to the job buffers in the current frame */
+    BYTE chainBuild;    /* the match table is built from hash chains in the current frame */
 #ifndef FL2_SINGLETHREAD
     U32 timeout;
 #endif
     U32 rmfWeight;
     U32 encWeight;
-    FL2_atomic progressIn;
-    FL2_atomic progressOut;
+    FL2_atomic64 progressIn;
+    FL2_atomic64 progressOut;
     int canceled;
     BYTE wroteProp;
     BYTE endMarked;
     BYTE loopCount;
     BYTE lockParams;
+    BYTE prefaultTable;
+    BYTE prefaultDict;
+    BYTE numaPlaced;
+    FL2_numa numa;
     unsigned jobCount;
     FL2_job jobs[1];
 };
@@ -458,7 +458,7 @@ struct FL2_DStream_s
     size_t asyncRes;
     U64 streamTotal;
     size_t overlapSize;
-    FL2_atomic progress;
+    FL2_atomic64 progress;
     unsigned timeout;
 #ifndef NO_XXHASH
     XXH32_state_t *xxh;
@@ -485,7 +485,7 @@ static size_t FL2_decompressInput(FL2_DStream* fds, FL2_outBuffer* output, FL2_i
         if (fds->doHash)
             XXH32_update(fds->xxh, (BYTE*)output->dst + output->pos, destSize);
 #endif
-        FL2_atomic_add(fds->progress, (long)destSize);
+        FL2_atomic_add64(fds->progress, (long long)destSize);
 
         output->pos += destSize;
         input->pos += srcSize;
@@ -743,7 +743,7 @@ static size_t FL2_decompressBlockMt(FL2_DStream* const fds, size_t const thread)
 
         CHECK_F(res);
 
-        FL2_atomic_add(fds->progress, (long)(dec->dic_pos - dicPos));
+        FL2_atomic_add64(fds->progress, (long long)(dec->dic_pos - dicPos));
 
         if (res == LZMA_STATUS_FINISHED)
             DEBUGLOG(4, "Found end mark");
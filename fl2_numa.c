@@ -0,0 +1,208 @@
+/*
+* Copyright (c) 2019, Conor McCarthy
+* All rights reserved.
+*
+* This source code is licensed under both the BSD-style license (found in the
+* LICENSE file in the root directory of this source tree) and the GPLv2 (found
+* in the COPYING file in the root directory of this source tree).
+* You may select, at your option, one of the above-listed licenses.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "fl2_numa.h"
+#include "fl2_internal.h"
+
+#if defined(__linux__) && !defined(FL2_SINGLETHREAD)
+#  include <unistd.h>
+#  include <sys/syscall.h>
+#  if defined(SYS_mbind) && defined(SYS_sched_setaffinity) && defined(SYS_sched_getaffinity)
+#    define FL2_NUMA_LINUX
+#  endif
+#endif
+
+#ifdef FL2_NUMA_LINUX
+
+/* From linux/mempolicy.h, which isn't always installed */
+#define NUMA_MPOL_PREFERRED 1
+#define NUMA_MPOL_INTERLEAVE 3
+#define NUMA_MPOL_MF_MOVE (1 << 1)
+
+#define MASK_BITS (8 * sizeof(unsigned long))
+/* mbind() reads maxnode - 1 bits of the node mask, and maxnode is node_count + 1 */
+#define NODE_MASK_WORDS ((FL2_NUMA_MAX_NODES + MASK_BITS) / MASK_BITS)
+
+/* The affinity of each thread before its first pin, restored when the policy is disabled */
+static __thread int numa_pinned;
+static __thread unsigned long numa_saved_mask[FL2_NUMA_MASK_WORDS];
+
+/* Parse a list such as "0-3,8-11" into a CPU mask */
+static int FL2_numaParseList(const char* const path, unsigned long* const mask)
+{
+    FILE* const f = fopen(path, "r");
+    if (f == NULL)
+        return 0;
+    int found = 0;
+    unsigned first, last;
+    int c;
+    while (fscanf(f, "%u", &first) == 1) {
+        last = first;
+        c = fgetc(f);
+        if (c == '-') {
+            if (fscanf(f, "%u", &last) != 1)
+                break;
+            c = fgetc(f);
+        }
+        for (; first <= last && first < FL2_NUMA_MAX_CPUS; ++first) {
+            mask[first / MASK_BITS] |= 1UL << (first % MASK_BITS);
+            found = 1;
+        }
+        if (c != ',')
+            break;
+    }
+    fclose(f);
+    return found;
+}
+
+static unsigned FL2_numaReadNodes(FL2_numa* const numa)
+{
+    unsigned node = 0;
+    for (; node < FL2_NUMA_MAX_NODES; ++node) {
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", node);
+        if (!FL2_numaParseList(path, numa->cpus[node]))
+            break;
+    }
+    return node;
+}
+
+static void FL2_numaSimulate(FL2_numa* const numa, unsigned const node_count)
+{
+    unsigned long online[FL2_NUMA_MASK_WORDS];
+    memset(online, 0, sizeof(online));
+    if (!FL2_numaParseList("/sys/devices/system/cpu/online", online))
+        online[0] = 1;
+    unsigned cpu_count = 0;
+    for (unsigned cpu = 0; cpu < FL2_NUMA_MAX_CPUS; ++cpu)
+        cpu_count += (online[cpu / MASK_BITS] >> (cpu % MASK_BITS)) & 1;
+    /* Consecutive CPUs go to the same node, as on real hardware */
+    unsigned i = 0;
+    for (unsigned cpu = 0; cpu < FL2_NUMA_MAX_CPUS; ++cpu) {
+        if ((online[cpu / MASK_BITS] >> (cpu % MASK_BITS)) & 1) {
+            unsigned const node = (unsigned)(((size_t)i * node_count) / cpu_count);
+            numa->cpus[node][cpu / MASK_BITS] |= 1UL << (cpu % MASK_BITS);
+            ++i;
+        }
+    }
+    numa->node_count = node_count;
+    numa->simulated = 1;
+}
+
+#endif /* FL2_NUMA_LINUX */
+
+void FL2_numaInit(FL2_numa* const numa, unsigned const policy)
+{
+    memset(numa, 0, sizeof(*numa));
+    numa->policy = policy;
+    numa->node_count = 1;
+#ifdef FL2_NUMA_LINUX
+    if (policy == 1) {
+        unsigned const node_count = FL2_numaReadNodes(numa);
+        if (node_count > 1)
+            numa->node_count = node_count;
+    }
+    else if (policy > 1) {
+        memset(numa->cpus, 0, sizeof(numa->cpus));
+        FL2_numaSimulate(numa, MIN(policy, FL2_NUMA_MAX_NODES));
+    }
+#endif
+    DEBUGLOG(4, "FL2_numaInit : policy %u, %u nodes%s", policy, numa->node_count, numa->simulated ? " (simulated)" : "");
+}
+
+unsigned FL2_numaJobNode(const FL2_numa* const numa, size_t const n, size_t const job_count)
+{
+    return (unsigned)((n * numa->node_count) / job_count);
+}
+
+void FL2_numaPinThread(const FL2_numa* const numa, unsigned const node)
+{
+#ifdef FL2_NUMA_LINUX
+    if (numa->node_count > 1) {
+        const unsigned long* const mask = numa->cpus[node];
+        size_t i = 0;
+        while (i < FL2_NUMA_MASK_WORDS && mask[i] == 0)
+            ++i;
+        /* Simulating more nodes than CPUs leaves some empty */
+        if (i < FL2_NUMA_MASK_WORDS) {
+            if (!numa_pinned) {
+                memset(numa_saved_mask, 0, sizeof(numa_saved_mask));
+                if (syscall(SYS_sched_getaffinity, 0, sizeof(numa_saved_mask), numa_saved_mask) <= 0)
+                    return;
+                numa_pinned = 1;
+            }
+            syscall(SYS_sched_setaffinity, 0, sizeof(numa->cpus[node]), mask);
+        }
+    }
+#else
+    (void)numa;
+    (void)node;
+#endif
+}
+
+void FL2_numaUnpinThread(void)
+{
+#ifdef FL2_NUMA_LINUX
+    if (numa_pinned) {
+        syscall(SYS_sched_setaffinity, 0, sizeof(numa_saved_mask), numa_saved_mask);
+        numa_pinned = 0;
+    }
+#endif
+}
+
+#ifdef FL2_NUMA_LINUX
+static void FL2_numaPolicy(const FL2_numa* const numa, void* const ptr, size_t const size, int const mode, const unsigned long* const nodes)
+{
+    size_t const page = (size_t)sysconf(_SC_PAGESIZE);
+    /* Whole pages only, because others may share the partial ones */
+    size_t const start = ((size_t)ptr + page - 1) & ~(page - 1);
+    size_t const end = ((size_t)ptr + size) & ~(page - 1);
+    if (end <= start)
+        return;
+    DEBUGLOG(5, "FL2_numaPolicy : mode %d, nodes %lX, %u bytes", mode, nodes[0], (unsigned)(end - start));
+    if (numa->simulated)
+        return;
+    syscall(SYS_mbind, (void*)start, end - start, mode, nodes, (unsigned long)numa->node_count + 1, NUMA_MPOL_MF_MOVE);
+}
+#endif
+
+void FL2_numaInterleave(const FL2_numa* const numa, void* const ptr, size_t const size)
+{
+#ifdef FL2_NUMA_LINUX
+    if (numa->node_count > 1) {
+        unsigned long nodes[NODE_MASK_WORDS] = { 0 };
+        for (unsigned node = 0; node < numa->node_count; ++node)
+            nodes[node / MASK_BITS] |= 1UL << (node % MASK_BITS);
+        FL2_numaPolicy(numa, ptr, size, NUMA_MPOL_INTERLEAVE, nodes);
+    }
+#else
+    (void)numa;
+    (void)ptr;
+    (void)size;
+#endif
+}
+
+void FL2_numaPlace(const FL2_numa* const numa, void* const ptr, size_t const size, unsigned const node)
+{
+#ifdef FL2_NUMA_LINUX
+    if (numa->node_count > 1) {
+        unsigned long nodes[NODE_MASK_WORDS] = { 0 };
+        nodes[node / MASK_BITS] = 1UL << (node % MASK_BITS);
+        FL2_numaPolicy(numa, ptr, size, NUMA_MPOL_PREFERRED, nodes);
+    }
+#else
+    (void)numa;
+    (void)ptr;
+    (void)size;
+    (void)node;
+#endif
+}
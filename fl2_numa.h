@@ -0,0 +1,63 @@
+/*
+* Copyright (c) 2019, Conor McCarthy
+* All rights reserved.
+*
+* This source code is licensed under both the BSD-style license (found in the
+* LICENSE file in the root directory of this source tree) and the GPLv2 (found
+* in the COPYING file in the root directory of this source tree).
+* You may select, at your option, one of the above-listed licenses.
+*/
+
+#ifndef FL2_NUMA_H
+#define FL2_NUMA_H
+
+#include <stddef.h>   /* size_t */
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#define FL2_NUMA_MAX_NODES 64
+#define FL2_NUMA_MAX_CPUS 1024
+#define FL2_NUMA_MASK_WORDS (FL2_NUMA_MAX_CPUS / (8 * sizeof(unsigned long)))
+
+/* Node topology used to place memory and threads.
+ * A node_count of 1 disables all placement. */
+typedef struct {
+    unsigned policy;     /* FL2_p_numaPolicy value the topology was built for */
+    unsigned node_count;
+    int simulated;       /* nodes are a division of the CPUs; memory is not placed */
+    unsigned long cpus[FL2_NUMA_MAX_NODES][FL2_NUMA_MASK_WORDS];
+} FL2_numa;
+
+/*! FL2_numaInit() :
+ *  Build the topology for a policy. 0 = disabled, 1 = system nodes, n > 1 = simulate n nodes
+ *  by dividing the online CPUs. Falls back to one node if the system has only one or the
+ *  topology can't be read. */
+void FL2_numaInit(FL2_numa* const numa, unsigned const policy);
+
+/*! FL2_numaJobNode() :
+ *  @return : the node for job n of job_count. Jobs are assigned to nodes in contiguous groups. */
+unsigned FL2_numaJobNode(const FL2_numa* const numa, size_t const n, size_t const job_count);
+
+/*! FL2_numaPinThread() :
+ *  Restrict the calling thread to the CPUs of a node */
+void FL2_numaPinThread(const FL2_numa* const numa, unsigned const node);
+
+/*! FL2_numaUnpinThread() :
+ *  Restore the CPUs the calling thread had before it was first pinned, if it was */
+void FL2_numaUnpinThread(void);
+
+/*! FL2_numaInterleave() :
+ *  Interleave the whole pages of a buffer over all nodes. Pages already faulted are moved. */
+void FL2_numaInterleave(const FL2_numa* const numa, void* const ptr, size_t const size);
+
+/*! FL2_numaPlace() :
+ *  Prefer a node for the whole pages of a buffer. Pages already faulted are moved. */
+void FL2_numaPlace(const FL2_numa* const numa, void* const ptr, size_t const size, unsigned const node);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif /* FL2_NUMA_H */
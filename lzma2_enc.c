@@ -50,6 +50,7 @@ Public domain
 
 #define kNumFullDistancesBits (kEndPosModelIndex >> 1U)
 #define kNumFullDistances (1U << kNumFullDistancesBits)
+#define kNumFooterBitsMax ((kEndPosModelIndex >> 1U) - 2U) /* footer bits of the last slot coded with probabilities */
 
 #define kNumPositionBitsMax 4U
 #define kNumPositionStatesMax (1U << kNumPositionBitsMax)
@@ -69,6 +70,9 @@ Public domain
 #define kMatchLenMax (kMatchLenMin + kLenNumSymbolsTotal - 1U)
 
 #define kMatchesMax 65U /* Doesn't need to be larger than FL2_HYBRIDCYCLES_MAX + 1 */
+#define kHashWorkCycle 16U /* work of one step along the hash chain, in bytes compared */
+#define kHashWorkBudget 512U /* work per position the hash chain search may take in a block */
+#define kHashWorkBase (1U << 20) /* extra work allowed at the start of a block */
 
 #define kOptimizerEndSize 32U
 #define kOptimizerBufferSize (kMatchLenMax * 2U + kOptimizerEndSize)
@@ -185,10 +189,11 @@ typedef struct
 
 /*
  * Table and chain for 3-byte hash. Extra elements in hash_chain_3 are malloced.
+ * Positions can exceed 2^31, so empty entries are RADIX_NULL_LINK rather than negative.
  */
 typedef struct {
-    S32 table_3[1 << kHash3Bits];
-    S32 hash_chain_3[1];
+    U32 table_3[1 << kHash3Bits];
+    U32 hash_chain_3[1];
 } LZMA2_hc3;
 
 /*
@@ -233,6 +238,13 @@ struct LZMA2_ECtx_s
     ptrdiff_t hash_dict_3;
     ptrdiff_t hash_prev_index;
     ptrdiff_t hash_alloc_3;
+    /* Work of the hash chain search since hash_work_start. With the budget enabled,
+     * searches beyond it follow one link, which bounds the time per byte on
+     * pathological data. */
+    U64 hash_work;
+    size_t hash_work_start;
+    unsigned work_budget;
+    U64 degraded_searches;
 
     /* Temp output buffer before space frees up in the match table */
     BYTE out_buf[kTempBufferSize];
@@ -261,6 +273,10 @@ LZMA2_ECtx* LZMA2_createECtx(void)
     enc->hash_dict_3 = 0;
     enc->chain_mask_3 = 0;
     enc->hash_alloc_3 = 0;
+    enc->hash_work = 0;
+    enc->hash_work_start = 0;
+    enc->work_budget = 0;
+    enc->degraded_searches = 0;
     return enc;
 }
 
@@ -272,7 +288,16 @@ void LZMA2_freeECtx(LZMA2_ECtx *const enc)
     free(enc);
 }
 
-#define LITERAL_PROBS(enc, pos, prev_symbol) (enc->states.literal_probs + ((((pos) & enc->lit_pos_mask) << enc->lc) + ((prev_symbol) >> (8 - enc->lc))) * kNumLiterals * kNumLitTables)
+/* lc and the masks for lp and pb. The template-like functions take these by value so that
+ * each specialized chunk encoder sees them as constants. */
+typedef struct
+{
+    unsigned lc;
+    size_t lit_pos_mask;
+    size_t pos_mask;
+} LZMA2_lcLpPb;
+
+#define LITERAL_PROBS(enc, lclppb, pos, prev_symbol) (enc->states.literal_probs + ((((pos) & (lclppb).lit_pos_mask) << (lclppb).lc) + ((prev_symbol) >> (8 - (lclppb).lc))) * kNumLiterals * kNumLitTables)
 
 #define LEN_TO_DIST_STATE(len) (((len) < kNumLenToPosStates + 1) ? (len) - 2 : kNumLenToPosStates - 1)
 
@@ -334,12 +359,12 @@ static unsigned LZMA_getLiteralPriceMatched(const LZMA2_prob *const prob_table,
 }
 
 HINT_INLINE
-void LZMA_encodeLiteral(LZMA2_ECtx *const enc, size_t const pos, U32 symbol, unsigned const prev_symbol)
+void LZMA_encodeLiteral(LZMA2_ECtx *const enc, LZMA2_lcLpPb const lclppb, size_t const pos, U32 symbol, unsigned const prev_symbol)
 {
-    RC_encodeBit0(&enc->rc, &enc->states.is_match[enc->states.state][pos & enc->pos_mask]);
+    RC_encodeBit0(&enc->rc, &enc->states.is_match[enc->states.state][pos & lclppb.pos_mask]);
     enc->states.state = LIT_NEXT_STATE(enc->states.state);
 
-    LZMA2_prob* const prob_table = LITERAL_PROBS(enc, pos, prev_symbol);
+    LZMA2_prob* const prob_table = LITERAL_PROBS(enc, lclppb, pos, prev_symbol);
     symbol |= 0x100;
     do {
         RC_encodeBit(&enc->rc, prob_table + (symbol >> 8), symbol & (1 << 7));
@@ -348,13 +373,13 @@ void LZMA_encodeLiteral(LZMA2_ECtx *const enc, size_t const pos, U32 symbol, uns
 }
 
 HINT_INLINE
-void LZMA_encodeLiteralMatched(LZMA2_ECtx *const enc, const BYTE* const data_block, size_t const pos, U32 symbol)
+void LZMA_encodeLiteralMatched(LZMA2_ECtx *const enc, LZMA2_lcLpPb const lclppb, const BYTE* const data_block, size_t const pos, U32 symbol)
 {
-    RC_encodeBit0(&enc->rc, &enc->states.is_match[enc->states.state][pos & enc->pos_mask]);
+    RC_encodeBit0(&enc->rc, &enc->states.is_match[enc->states.state][pos & lclppb.pos_mask]);
     enc->states.state = LIT_NEXT_STATE(enc->states.state);
 
     unsigned match_symbol = data_block[pos - enc->states.reps[0] - 1];
-    LZMA2_prob* const prob_table = LITERAL_PROBS(enc, pos, data_block[pos - 1]);
+    LZMA2_prob* const prob_table = LITERAL_PROBS(enc, lclppb, pos, data_block[pos - 1]);
     unsigned offset = 0x100;
     symbol |= 0x100;
     do {
@@ -367,15 +392,58 @@ void LZMA_encodeLiteralMatched(LZMA2_ECtx *const enc, const BYTE* const data_blo
 }
 
 HINT_INLINE
-void LZMA_encodeLiteralBuf(LZMA2_ECtx *const enc, const BYTE* const data_block, size_t const pos)
+void LZMA_encodeLiteralBuf(LZMA2_ECtx *const enc, LZMA2_lcLpPb const lclppb, const BYTE* const data_block, size_t const pos)
 {
     U32 const symbol = data_block[pos];
     if (IS_LIT_STATE(enc->states.state)) {
         unsigned const prev_symbol = data_block[pos - 1];
-        LZMA_encodeLiteral(enc, pos, symbol, prev_symbol);
+        LZMA_encodeLiteral(enc, lclppb, pos, symbol, prev_symbol);
     }
     else {
-        LZMA_encodeLiteralMatched(enc, data_block, pos, symbol);
+        LZMA_encodeLiteralMatched(enc, lclppb, data_block, pos, symbol);
+    }
+}
+
+/* Fill prices[0..count) with start_price plus the price of each symbol in a bit tree of
+ * bit_count levels. Each node's price is its parent's plus one bit, so the levels shared
+ * by many symbols are summed once instead of once per symbol. */
+static void LZMA_fillTreePrices(const LZMA2_prob* const probs, unsigned const bit_count, size_t const count, U32 const start_price, unsigned* const prices)
+{
+    U32 node[kLenNumHighSymbols];
+    if (count == 0)
+        return;
+    size_t const top = ((size_t)1 << bit_count) | (count - 1);
+
+    node[1] = start_price;
+    for (unsigned level = 1; level < bit_count; ++level) {
+        size_t const last = top >> (bit_count - level);
+        for (size_t n = (size_t)1 << level; n <= last; ++n)
+            node[n] = node[n >> 1] + GET_PRICE(probs[n >> 1], n & 1);
+    }
+    for (size_t sym = 0; sym < count; ++sym) {
+        size_t const leaf = ((size_t)1 << bit_count) | sym;
+        prices[sym] = node[leaf >> 1] + GET_PRICE(probs[leaf >> 1], leaf & 1);
+    }
+}
+
+/* As LZMA_fillTreePrices() for all symbols of a reverse bit tree, which codes the lowest bit first.
+ * Symbols sharing their low bits share a node, so the prices are built up from the lowest bit. */
+static void LZMA_fillReverseTreePrices(const LZMA2_prob* const probs, unsigned const bit_count, unsigned* const prices)
+{
+    size_t node[(size_t)1 << kNumFooterBitsMax];
+
+    prices[0] = 0;
+    node[0] = 1;
+    for (unsigned k = 0; k < bit_count; ++k) {
+        size_t const half = (size_t)1 << k;
+        for (size_t low = 0; low < half; ++low) {
+            size_t const m = node[low];
+            U32 const price = prices[low];
+            prices[low + half] = price + GET_PRICE_1(probs[m]);
+            node[low + half] = (m << 1) + 1;
+            prices[low] = price + GET_PRICE_0(probs[m]);
+            node[low] = m << 1;
+        }
     }
 }
 
@@ -409,27 +477,11 @@ static void LZMA_lengthStates_updatePrices(LZMA2_ECtx *const enc, LZMA2_lenState
         }
     }
 
-    size_t i = ls->table_size;
-
-    if (i > kLenNumLowSymbols * 2) {
-        const LZMA2_prob *const probs = ls->high;
-        unsigned *const prices = ls->prices[0] + kLenNumLowSymbols * 2;
-        i = (i - (kLenNumLowSymbols * 2 - 1)) >> 1;
+    if (ls->table_size > kLenNumLowSymbols * 2) {
+        /* Symbols are filled in pairs */
+        size_t const count = (ls->table_size - (kLenNumLowSymbols * 2 - 1)) & ~(size_t)1;
         b += GET_PRICE_1(ls->low[0]);
-        do {
-            --i;
-            size_t sym = i + (1 << (kLenNumHighBits - 1));
-            U32 price = b;
-            do {
-                size_t bit = sym & 1;
-                sym >>= 1;
-                price += GET_PRICE(probs[sym], bit);
-            } while (sym >= 2);
-
-            unsigned const prob = probs[i + (1 << (kLenNumHighBits - 1))];
-            prices[i * 2] = price + GET_PRICE_0(prob);
-            prices[i * 2 + 1] = price + GET_PRICE_1(prob);
-        } while (i);
+        LZMA_fillTreePrices(ls->high, kLenNumHighBits, count, b, ls->prices[0] + kLenNumLowSymbols * 2);
 
         size_t const size = (ls->table_size - kLenNumLowSymbols * 2) * sizeof(ls->prices[0][0]);
         for (size_t pos_state = 1; pos_state <= enc->pos_mask; pos_state++)
@@ -579,11 +631,12 @@ FORCE_INLINE_TEMPLATE
 size_t LZMA_encodeChunkFast(LZMA2_ECtx *const enc,
     FL2_dataBlock const block,
     FL2_matchTable* const tbl,
-    int const struct_tbl,
+    int const tbl_format,
+    LZMA2_lcLpPb const lclppb,
     size_t pos,
     size_t const uncompressed_end)
 {
-    size_t const pos_mask = enc->pos_mask;
+    size_t const pos_mask = lclppb.pos_mask;
     size_t prev = pos;
     unsigned const search_depth = tbl->params.depth;
 
@@ -593,7 +646,7 @@ size_t LZMA_encodeChunkFast(LZMA2_ECtx *const enc,
         /* Table of distance restrictions for short matches */
         static const U32 max_dist_table[] = { 0, 0, 0, 1 << 6, 1 << 14 };
         /* Get a match from the table, extended to its full length */
-        RMF_match best_match = RMF_getMatch(block, tbl, search_depth, struct_tbl, pos);
+        RMF_match best_match = RMF_getMatch(block, tbl, search_depth, tbl_format, pos);
         if (best_match.length < kMatchLenMin) {
             ++pos;
             continue;
@@ -649,7 +702,7 @@ size_t LZMA_encodeChunkFast(LZMA2_ECtx *const enc,
 
         for (size_t next = pos + 1; best_match.length < kMatchLenMax && next < uncompressed_end; ++next) {
             /* lazy matching scheme from ZSTD */
-            RMF_match next_match = RMF_getNextMatch(block, tbl, search_depth, struct_tbl, next);
+            RMF_match next_match = RMF_getNextMatch(block, tbl, search_depth, tbl_format, next);
             if (next_match.length >= kMatchLenMin) {
                 best_rep.length = 0;
                 data = block.data + next;
@@ -689,7 +742,7 @@ size_t LZMA_encodeChunkFast(LZMA2_ECtx *const enc,
             if (next >= uncompressed_end)
                 break;
 
-            next_match = RMF_getNextMatch(block, tbl, search_depth, struct_tbl, next);
+            next_match = RMF_getNextMatch(block, tbl, search_depth, tbl_format, next);
             if (next_match.length < 4)
                 break;
 
@@ -737,7 +790,7 @@ _encode:
                 return prev;
 
             if (block.data[prev] != block.data[prev - enc->states.reps[0] - 1]) {
-                LZMA_encodeLiteralBuf(enc, block.data, prev);
+                LZMA_encodeLiteralBuf(enc, lclppb, block.data, prev);
                 ++prev;
             }
             else {
@@ -761,7 +814,7 @@ _encode:
     }
     while (prev < pos && enc->rc.out_index < enc->chunk_limit) {
         if (block.data[prev] != block.data[prev - enc->states.reps[0] - 1])
-            LZMA_encodeLiteralBuf(enc, block.data, prev);
+            LZMA_encodeLiteralBuf(enc, lclppb, block.data, prev);
         else
             LZMA_encodeRepMatchShort(enc, prev & pos_mask);
         ++prev;
@@ -814,9 +867,10 @@ static void LZMA_reverseOptimalChain(LZMA2_node* const opt_buf, size_t cur)
     }
 }
 
-static unsigned LZMA_getLiteralPrice(LZMA2_ECtx *const enc, size_t const pos, size_t const state, unsigned const prev_symbol, U32 symbol, unsigned const match_byte)
+HINT_INLINE
+unsigned LZMA_getLiteralPrice(LZMA2_ECtx *const enc, LZMA2_lcLpPb const lclppb, size_t const pos, size_t const state, unsigned const prev_symbol, U32 symbol, unsigned const match_byte)
 {
-    const LZMA2_prob* const prob_table = LITERAL_PROBS(enc, pos, prev_symbol);
+    const LZMA2_prob* const prob_table = LITERAL_PROBS(enc, lclppb, pos, prev_symbol);
     if (IS_LIT_STATE(state)) {
         unsigned price = 0;
         symbol |= 0x100;
@@ -850,7 +904,7 @@ static int LZMA_hashCreate(LZMA2_ECtx *const enc, unsigned const dictionary_bits
         free(enc->hash_buf);
 
     enc->hash_alloc_3 = (ptrdiff_t)1 << dictionary_bits_3;
-    enc->hash_buf = malloc(sizeof(LZMA2_hc3) + (enc->hash_alloc_3 - 1) * sizeof(S32));
+    enc->hash_buf = malloc(sizeof(LZMA2_hc3) + (enc->hash_alloc_3 - 1) * sizeof(U32));
 
     if (enc->hash_buf == NULL)
         return 1;
@@ -872,6 +926,14 @@ int LZMA2_hashAlloc(LZMA2_ECtx *const enc, const FL2_lzma2Parameters* const opti
     return 0;
 }
 
+/* Place the encoder state and hash chain on a NUMA node */
+void LZMA2_numaPlace(LZMA2_ECtx *const enc, const FL2_numa* const numa, unsigned const node)
+{
+    FL2_numaPlace(numa, enc, sizeof(LZMA2_ECtx), node);
+    if (enc->hash_buf != NULL)
+        FL2_numaPlace(numa, enc->hash_buf, sizeof(LZMA2_hc3) + (enc->hash_alloc_3 - 1) * sizeof(U32), node);
+}
+
 #define GET_HASH_3(data) ((((MEM_readLE32(data)) << 8) * 506832829U) >> (32 - kHash3Bits))
 
 /* Find matches nearer than the match from the RMF. If none is at least as long as
@@ -894,18 +956,22 @@ size_t LZMA_hashGetMatches(LZMA2_ECtx *const enc, FL2_dataBlock const block,
     while (++enc->hash_prev_index < pos) {
         size_t hash = GET_HASH_3(data + enc->hash_prev_index);
         tbl->hash_chain_3[enc->hash_prev_index & chain_mask_3] = tbl->table_3[hash];
-        tbl->table_3[hash] = (S32)enc->hash_prev_index;
+        tbl->table_3[hash] = (U32)enc->hash_prev_index;
     }
     data += pos;
 
     size_t const hash = GET_HASH_3(data);
-    ptrdiff_t const first_3 = tbl->table_3[hash];
-    tbl->table_3[hash] = (S32)pos;
+    U32 const first_3 = tbl->table_3[hash];
+    tbl->table_3[hash] = (U32)pos;
 
     size_t max_len = 2;
 
-    if (first_3 >= 0) {
+    if (first_3 != RADIX_NULL_LINK) {
         int cycles = enc->match_cycles;
+        if (enc->work_budget && enc->hash_work > (U64)(pos - enc->hash_work_start) * kHashWorkBudget + kHashWorkBase) {
+            cycles = 1;
+            ++enc->degraded_searches;
+        }
         ptrdiff_t const end_index = pos - (((ptrdiff_t)match.dist < hash_dict_3) ? match.dist : hash_dict_3);
         ptrdiff_t match_3 = first_3;
         if (match_3 >= end_index) {
@@ -913,6 +979,7 @@ size_t LZMA_hashGetMatches(LZMA2_ECtx *const enc, FL2_dataBlock const block,
                 --cycles;
                 const BYTE* data_2 = block.data + match_3;
                 size_t len_test = ZSTD_count(data + 1, data_2 + 1, data + length_limit) + 1;
+                enc->hash_work += len_test + kHashWorkCycle;
                 if (len_test > max_len) {
                     enc->matches[enc->match_count].length = (U32)len_test;
                     enc->matches[enc->match_count].dist = (U32)(pos - match_3 - 1);
@@ -923,11 +990,14 @@ size_t LZMA_hashGetMatches(LZMA2_ECtx *const enc, FL2_dataBlock const block,
                 }
                 if (cycles <= 0)
                     break;
-                match_3 = tbl->hash_chain_3[match_3 & chain_mask_3];
+                U32 const next_3 = tbl->hash_chain_3[match_3 & chain_mask_3];
+                if (next_3 == RADIX_NULL_LINK)
+                    break;
+                match_3 = next_3;
             } while (match_3 >= end_index);
         }
     }
-    tbl->hash_chain_3[pos & chain_mask_3] = (S32)first_3;
+    tbl->hash_chain_3[pos & chain_mask_3] = first_3;
     if ((unsigned)max_len < match.length) {
         /* Insert the match from the RMF */
         enc->matches[enc->match_count] = match;
@@ -952,10 +1022,11 @@ size_t LZMA_optimalParse(LZMA2_ECtx* const enc, FL2_dataBlock const block,
     size_t const cur,
     size_t len_end,
     int const is_hybrid,
+    LZMA2_lcLpPb const lclppb,
     U32* const reps)
 {
     LZMA2_node* const cur_opt = &enc->opt_buf[cur];
-    size_t const pos_mask = enc->pos_mask;
+    size_t const pos_mask = lclppb.pos_mask;
     size_t const pos_state = (pos & pos_mask);
     const BYTE* const data = block.data + pos;
     size_t const fast_length = enc->fast_length;
@@ -1022,7 +1093,7 @@ size_t LZMA_optimalParse(LZMA2_ECtx* const enc, FL2_dataBlock const block,
         BYTE try_lit = cur_and_lit_price + kMinLitPrice / 2U <= next_price;
         if (try_lit) {
             /* cur_and_lit_price is used later for the literal + rep0 test */
-            cur_and_lit_price += LZMA_getLiteralPrice(enc, pos, state, data[-1], cur_byte, match_byte);
+            cur_and_lit_price += LZMA_getLiteralPrice(enc, lclppb, pos, state, data[-1], cur_byte, match_byte);
             /* Try literal */
             if (cur_and_lit_price < next_price) {
                 next_opt->price = cur_and_lit_price;
@@ -1118,7 +1189,7 @@ size_t LZMA_optimalParse(LZMA2_ECtx* const enc, FL2_dataBlock const block,
                 U32 rep_lit_rep_total_price =
                     cur_rep_price + enc->states.rep_len_states.prices[pos_state][len_test - kMatchLenMin]
                     + GET_PRICE_0(enc->states.is_match[state_2][pos_state_next])
-                    + LZMA_getLiteralPriceMatched(LITERAL_PROBS(enc, pos + len_test, data[len_test - 1]),
+                    + LZMA_getLiteralPriceMatched(LITERAL_PROBS(enc, lclppb, pos + len_test, data[len_test - 1]),
                         data[len_test], data_2[len_test]);
 
                 state_2 = kState_LitAfterRep;
@@ -1228,7 +1299,7 @@ size_t LZMA_optimalParse(LZMA2_ECtx* const enc, FL2_dataBlock const block,
                         size_t pos_state_next = (pos + len_test) & pos_mask;
                         U32 match_lit_rep_total_price = cur_and_len_price +
                             GET_PRICE_0(enc->states.is_match[state_2][pos_state_next]) +
-                            LZMA_getLiteralPriceMatched(LITERAL_PROBS(enc, pos + len_test, data[len_test - 1]),
+                            LZMA_getLiteralPriceMatched(LITERAL_PROBS(enc, lclppb, pos + len_test, data[len_test - 1]),
                                 data[len_test], data_2[len_test]);
 
                         state_2 = kState_LitAfterMatch;
@@ -1350,6 +1421,7 @@ size_t LZMA_initOptimizerPos0(LZMA2_ECtx *const enc, FL2_dataBlock const block,
     RMF_match const match,
     size_t const pos,
     int const is_hybrid,
+    LZMA2_lcLpPb const lclppb,
     U32* const reps)
 {
     size_t const max_length = MIN(block.end - pos, kMatchLenMax);
@@ -1384,14 +1456,14 @@ size_t LZMA_initOptimizerPos0(LZMA2_ECtx *const enc, FL2_dataBlock const block,
     unsigned const cur_byte = *data;
     unsigned const match_byte = *(data - reps[0] - 1);
     size_t const state = enc->states.state;
-    size_t const pos_state = pos & enc->pos_mask;
+    size_t const pos_state = pos & lclppb.pos_mask;
     LZMA2_prob const is_match_prob = enc->states.is_match[state][pos_state];
     LZMA2_prob const is_rep_prob = enc->states.is_rep[state];
 
     enc->opt_buf[0].state = state;
     /* Set the price for literal */
     enc->opt_buf[1].price = GET_PRICE_0(is_match_prob) +
-        LZMA_getLiteralPrice(enc, pos, state, data[-1], cur_byte, match_byte);
+        LZMA_getLiteralPrice(enc, lclppb, pos, state, data[-1], cur_byte, match_byte);
     MARK_LITERAL(enc->opt_buf[1]);
 
     unsigned const match_price = GET_PRICE_1(is_match_prob);
@@ -1442,8 +1514,9 @@ size_t LZMA_initOptimizerPos0(LZMA2_ECtx *const enc, FL2_dataBlock const block,
 FORCE_INLINE_TEMPLATE
 size_t LZMA_encodeOptimumSequence(LZMA2_ECtx *const enc, FL2_dataBlock const block,
     FL2_matchTable* const tbl,
-    int const struct_tbl,
+    int const tbl_format,
     int const is_hybrid,
+    LZMA2_lcLpPb const lclppb,
     size_t start_index,
     size_t const uncompressed_end,
     RMF_match match)
@@ -1451,7 +1524,7 @@ size_t LZMA_encodeOptimumSequence(LZMA2_ECtx *const enc, FL2_dataBlock const blo
     size_t len_end = enc->len_end_max;
     unsigned const search_depth = tbl->params.depth;
     do {
-        size_t const pos_mask = enc->pos_mask;
+        size_t const pos_mask = lclppb.pos_mask;
 
         /* Reset all prices that were set last time */
         for (; (len_end & 3) != 0; --len_end)
@@ -1466,7 +1539,7 @@ size_t LZMA_encodeOptimumSequence(LZMA2_ECtx *const enc, FL2_dataBlock const blo
         /* Set everything up at position 0 */
         size_t pos = start_index;
         U32 reps[kNumReps];
-        len_end = LZMA_initOptimizerPos0(enc, block, match, pos, is_hybrid, reps);
+        len_end = LZMA_initOptimizerPos0(enc, block, match, pos, is_hybrid, lclppb, reps);
         match.length = 0;
         size_t cur = 1;
 
@@ -1505,11 +1578,11 @@ size_t LZMA_encodeOptimumSequence(LZMA2_ECtx *const enc, FL2_dataBlock const blo
                     }
                 }
 
-                match = RMF_getMatch(block, tbl, search_depth, struct_tbl, pos);
+                match = RMF_getMatch(block, tbl, search_depth, tbl_format, pos);
                 if (match.length >= enc->fast_length)
                     break;
 
-                len_end = LZMA_optimalParse(enc, block, match, pos, cur, len_end, is_hybrid, reps);
+                len_end = LZMA_optimalParse(enc, block, match, pos, cur, len_end, is_hybrid, lclppb, reps);
             }
 reverse:
             DEBUGLOG(6, "End optimal parse at %u", (U32)cur);
@@ -1521,7 +1594,7 @@ reverse:
             unsigned const len = enc->opt_buf[i].len;
 
             if (len == 1 && enc->opt_buf[i].dist == kNullDist) {
-                LZMA_encodeLiteralBuf(enc, block.data, start_index + i);
+                LZMA_encodeLiteralBuf(enc, lclppb, block.data, start_index + i);
                 ++i;
             }
             else {
@@ -1554,20 +1627,7 @@ reverse:
 
 static void FORCE_NOINLINE LZMA_fillAlignPrices(LZMA2_ECtx *const enc)
 {
-    unsigned i;
-    const LZMA2_prob *const probs = enc->states.dist_align_encoders;
-    for (i = 0; i < kAlignTableSize / 2; i++) {
-        U32 price = 0;
-        unsigned sym = i;
-        unsigned m = 1;
-        unsigned bit;
-        bit = sym & 1; sym >>= 1; price += GET_PRICE(probs[m], bit); m = (m << 1) + bit;
-        bit = sym & 1; sym >>= 1; price += GET_PRICE(probs[m], bit); m = (m << 1) + bit;
-        bit = sym & 1; sym >>= 1; price += GET_PRICE(probs[m], bit); m = (m << 1) + bit;
-        U32 const prob = probs[m];
-        enc->align_prices[i] = price + GET_PRICE_0(prob);
-        enc->align_prices[i + 8] = price + GET_PRICE_1(prob);
-    }
+    LZMA_fillReverseTreePrices(enc->states.dist_align_encoders, kNumAlignBits, enc->align_prices);
 }
 
 static void FORCE_NOINLINE LZMA_fillDistancesPrices(LZMA2_ECtx *const enc)
@@ -1576,50 +1636,19 @@ static void FORCE_NOINLINE LZMA_fillDistancesPrices(LZMA2_ECtx *const enc)
 
     enc->match_price_count = 0;
 
-    for (size_t i = kStartPosModelIndex / 2; i < kNumFullDistances / 2; i++) {
-        unsigned const dist_slot = distance_table[i];
-        unsigned footer_bits = (dist_slot >> 1) - 1;
-        size_t base = ((2 | (dist_slot & 1)) << footer_bits);
-        const LZMA2_prob *probs = enc->states.dist_encoders + base * 2U;
-        base += i;
-        probs = probs - distance_table[base] - 1;
-        U32 price = 0;
-        unsigned m = 1;
-        unsigned sym = (unsigned)i;
-        unsigned const offset = (unsigned)1 << footer_bits;
-
-        for (; footer_bits != 0; --footer_bits) {
-            unsigned bit = sym & 1;
-            sym >>= 1;
-            price += GET_PRICE(probs[m], bit);
-            m = (m << 1) + bit;
-        };
-
-        unsigned const prob = probs[m];
-        temp_prices[base] = price + GET_PRICE_0(prob);
-        temp_prices[base + offset] = price + GET_PRICE_1(prob);
+    /* The footer bits of each slot below kEndPosModelIndex, shared by all length states */
+    for (unsigned dist_slot = kStartPosModelIndex; dist_slot < kEndPosModelIndex; dist_slot++) {
+        unsigned const footer_bits = (dist_slot >> 1) - 1;
+        size_t const base = (2 | (dist_slot & 1)) << footer_bits;
+        LZMA_fillReverseTreePrices(enc->states.dist_encoders + base - dist_slot - 1, footer_bits, temp_prices + base);
     }
 
     for (unsigned lps = 0; lps < kNumLenToPosStates; lps++) {
         size_t slot;
         size_t const dist_table_size2 = (enc->dist_price_table_size + 1) >> 1;
         U32 *const dist_slot_prices = enc->dist_slot_prices[lps];
-        const LZMA2_prob *const probs = enc->states.dist_slot_encoders[lps];
-
-        for (slot = 0; slot < dist_table_size2; slot++) {
-            /* dist_slot_prices[slot] = RcTree_GetPrice(encoder, kNumPosSlotBits, slot, p->ProbPrices); */
-            U32 price;
-            unsigned bit;
-            unsigned sym = (unsigned)slot + (1 << (kNumPosSlotBits - 1));
-            bit = sym & 1; sym >>= 1; price = GET_PRICE(probs[sym], bit);
-            bit = sym & 1; sym >>= 1; price += GET_PRICE(probs[sym], bit);
-            bit = sym & 1; sym >>= 1; price += GET_PRICE(probs[sym], bit);
-            bit = sym & 1; sym >>= 1; price += GET_PRICE(probs[sym], bit);
-            bit = sym & 1; sym >>= 1; price += GET_PRICE(probs[sym], bit);
-            unsigned const prob = probs[slot + (1 << (kNumPosSlotBits - 1))];
-            dist_slot_prices[slot * 2] = price + GET_PRICE_0(prob);
-            dist_slot_prices[slot * 2 + 1] = price + GET_PRICE_1(prob);
-        }
+
+        LZMA_fillTreePrices(enc->states.dist_slot_encoders[lps], kNumPosSlotBits, dist_table_size2 * 2, 0, dist_slot_prices);
 
         {
             U32 delta = ((U32)((kEndPosModelIndex / 2 - 1) - kNumAlignBits) << kNumBitPriceShiftBits);
@@ -1638,10 +1667,12 @@ static void FORCE_NOINLINE LZMA_fillDistancesPrices(LZMA2_ECtx *const enc)
             dp[2] = dist_slot_prices[2];
             dp[3] = dist_slot_prices[3];
 
-            for (size_t i = 4; i < kNumFullDistances; i += 2) {
-                U32 slot_price = dist_slot_prices[distance_table[i]];
-                dp[i] = slot_price + temp_prices[i];
-                dp[i + 1] = slot_price + temp_prices[i + 1];
+            for (unsigned dist_slot = kStartPosModelIndex; dist_slot < kEndPosModelIndex; dist_slot++) {
+                U32 const slot_price = dist_slot_prices[dist_slot];
+                unsigned const footer_bits = (dist_slot >> 1) - 1;
+                size_t const base = (size_t)(2 | (dist_slot & 1)) << footer_bits;
+                for (size_t i = base; i < base + ((size_t)1 << footer_bits); i++)
+                    dp[i] = slot_price + temp_prices[i];
             }
         }
     }
@@ -1651,7 +1682,8 @@ FORCE_INLINE_TEMPLATE
 size_t LZMA_encodeChunkBest(LZMA2_ECtx *const enc,
     FL2_dataBlock const block,
     FL2_matchTable* const tbl,
-    int const struct_tbl,
+    int const tbl_format,
+    LZMA2_lcLpPb const lclppb,
     size_t pos,
     size_t const uncompressed_end)
 {
@@ -1663,14 +1695,14 @@ size_t LZMA_encodeChunkBest(LZMA2_ECtx *const enc,
 
     while (pos < uncompressed_end && enc->rc.out_index < enc->chunk_size)
     {
-        RMF_match const match = RMF_getMatch(block, tbl, search_depth, struct_tbl, pos);
+        RMF_match const match = RMF_getMatch(block, tbl, search_depth, tbl_format, pos);
         if (match.length > 1) {
             /* Template-like inline function */
             if (enc->strategy == FL2_ultra) {
-                pos = LZMA_encodeOptimumSequence(enc, block, tbl, struct_tbl, 1, pos, uncompressed_end, match);
+                pos = LZMA_encodeOptimumSequence(enc, block, tbl, tbl_format, 1, lclppb, pos, uncompressed_end, match);
             }
             else {
-                pos = LZMA_encodeOptimumSequence(enc, block, tbl, struct_tbl, 0, pos, uncompressed_end, match);
+                pos = LZMA_encodeOptimumSequence(enc, block, tbl, tbl_format, 0, lclppb, pos, uncompressed_end, match);
             }
             if (enc->match_price_count >= kMatchRepriceFrequency) {
                 LZMA_fillAlignPrices(enc);
@@ -1684,11 +1716,11 @@ size_t LZMA_encodeChunkBest(LZMA2_ECtx *const enc,
         }
         else {
             if (block.data[pos] != block.data[pos - enc->states.reps[0] - 1]) {
-                LZMA_encodeLiteralBuf(enc, block.data, pos);
+                LZMA_encodeLiteralBuf(enc, lclppb, block.data, pos);
                 ++pos;
             }
             else {
-                LZMA_encodeRepMatchShort(enc, pos & enc->pos_mask);
+                LZMA_encodeRepMatchShort(enc, pos & lclppb.pos_mask);
                 ++pos;
             }
         }
@@ -1767,8 +1799,25 @@ size_t LZMA2_compressBound(size_t src_size)
 	 * to account for thread_count incomplete end chunks per block. LZMA expansion is < 2% so 1/16
 	 * is a safe overestimate. */
 	static const unsigned chunk_min_avg = (kChunkSize - (kChunkSize / 16U)) / 2U;
-	/* Maximum size of data stored in a sequence of uncompressed chunks */
-	return src_size + ((src_size + chunk_min_avg - 1) / chunk_min_avg) * 3 + 6;
+	/* Maximum size of data stored in a sequence of uncompressed chunks. Each thread's slice of a
+	 * block is at least FL2_SLICE_SIZE_MIN and may end with one more incomplete chunk. */
+	return src_size + ((src_size + chunk_min_avg - 1) / chunk_min_avg + src_size / FL2_SLICE_SIZE_MIN) * 3 + 6;
+}
+
+size_t LZMA2_encodeBound(size_t src_size)
+{
+    /* A chunk is encoded in full before it is found to be incompressible and stored instead */
+    return LZMA2_compressBound(src_size) + kMaxChunkCompressedSize + kChunkHeaderSize + 1;
+}
+
+void LZMA2_resetStats(LZMA2_ECtx *const enc)
+{
+    enc->degraded_searches = 0;
+}
+
+U64 LZMA2_degradedSearches(const LZMA2_ECtx *const enc)
+{
+    return enc->degraded_searches;
 }
 
 size_t LZMA2_encMemoryUsage(unsigned const chain_log, FL2_strategy const strategy, unsigned const thread_count)
@@ -1835,7 +1884,7 @@ static BYTE LZMA2_isChunkIncompressible(const FL2_matchTable* const tbl,
 		size_t const margin = chunk_size / margin_divisor[strategy];
 		size_t const terminator = start + margin;
 
-		if (tbl->is_struct) {
+		if (tbl->format == RMF_TABLE_STRUCTURED) {
 			size_t prev_dist = 0;
 			for (size_t pos = start; pos < end; ) {
 				U32 const link = GetMatchLink(tbl->table, pos);
@@ -1862,6 +1911,29 @@ static BYTE LZMA2_isChunkIncompressible(const FL2_matchTable* const tbl,
 					return 0;
 			}
 		}
+		else if (tbl->format == RMF_TABLE_PACKED) {
+			size_t prev_dist = 0;
+			for (size_t pos = start; pos < end; ) {
+				U32 const link = RMF_packedGetLink(tbl->table, pos);
+				if (link == PACKED_NULL_LINK) {
+					++pos;
+					++count;
+					prev_dist = 0;
+				}
+				else {
+					size_t const length = RMF_packedGetLength(tbl->table, pos);
+					size_t const dist = pos - link;
+					if (length > 4)
+						count += dist != prev_dist;
+					else
+						count += (dist < max_dist_table[strategy][length]) ? 1 : length;
+					pos += length;
+					prev_dist = dist;
+				}
+				if (count + terminator <= pos)
+					return 0;
+			}
+		}
 		else {
 			size_t prev_dist = 0;
 			for (size_t pos = start; pos < end; ) {
@@ -1906,44 +1978,66 @@ static BYTE LZMA2_isChunkIncompressible(const FL2_matchTable* const tbl,
 	return 0;
 }
 
-static size_t LZMA2_encodeChunk(LZMA2_ECtx *const enc,
+typedef size_t (*LZMA2_chunkEncoder)(LZMA2_ECtx *const enc,
     FL2_matchTable* const tbl,
     FL2_dataBlock const block,
-    size_t const pos, size_t const uncompressed_end)
+    size_t const pos, size_t const uncompressed_end);
+
+/* Instantiate the template-like chunk encoders for one lc/lp/pb set and each table format.
+ * lc, lp and pb may be constants, or read from enc for the general case. */
+#define LZMA2_CHUNK_ENCODER(name, encode_fn, tbl_format, lc, lp, pb) \
+static size_t name(LZMA2_ECtx *const enc, \
+    FL2_matchTable* const tbl, \
+    FL2_dataBlock const block, \
+    size_t const pos, size_t const uncompressed_end) \
+{ \
+    LZMA2_lcLpPb const lclppb = { (lc), ((size_t)1 << (lp)) - 1, ((size_t)1 << (pb)) - 1 }; \
+    return encode_fn(enc, block, tbl, tbl_format, lclppb, pos, uncompressed_end); \
+}
+
+#define LZMA2_CHUNK_ENCODERS(suffix, lc, lp, pb) \
+    LZMA2_CHUNK_ENCODER(LZMA2_encodeChunkFastBitpack##suffix, LZMA_encodeChunkFast, RMF_TABLE_BITPACK, lc, lp, pb) \
+    LZMA2_CHUNK_ENCODER(LZMA2_encodeChunkFastStructured##suffix, LZMA_encodeChunkFast, RMF_TABLE_STRUCTURED, lc, lp, pb) \
+    LZMA2_CHUNK_ENCODER(LZMA2_encodeChunkFastPacked##suffix, LZMA_encodeChunkFast, RMF_TABLE_PACKED, lc, lp, pb) \
+    LZMA2_CHUNK_ENCODER(LZMA2_encodeChunkBestBitpack##suffix, LZMA_encodeChunkBest, RMF_TABLE_BITPACK, lc, lp, pb) \
+    LZMA2_CHUNK_ENCODER(LZMA2_encodeChunkBestStructured##suffix, LZMA_encodeChunkBest, RMF_TABLE_STRUCTURED, lc, lp, pb) \
+    LZMA2_CHUNK_ENCODER(LZMA2_encodeChunkBestPacked##suffix, LZMA_encodeChunkBest, RMF_TABLE_PACKED, lc, lp, pb)
+
+/* Indexed by [strategy != FL2_fast][table format] */
+#define LZMA2_CHUNK_ENCODER_SET(suffix) { \
+    { LZMA2_encodeChunkFastBitpack##suffix, LZMA2_encodeChunkFastStructured##suffix, LZMA2_encodeChunkFastPacked##suffix }, \
+    { LZMA2_encodeChunkBestBitpack##suffix, LZMA2_encodeChunkBestStructured##suffix, LZMA2_encodeChunkBestPacked##suffix } }
+
+LZMA2_CHUNK_ENCODERS(_any, enc->lc, enc->lp, enc->pb)
+
+/* The optimizing encoder on the bitpack table with the default lc/lp/pb is the only combination
+ * where constant masks gave a measurable gain. The others use the general encoders. */
+LZMA2_CHUNK_ENCODER(LZMA2_encodeChunkBestBitpack_3_0_2, LZMA_encodeChunkBest, RMF_TABLE_BITPACK, 3, 0, 2)
+
+static const LZMA2_chunkEncoder chunk_encoders[2][3] = LZMA2_CHUNK_ENCODER_SET(_any);
+
+/* Select the chunk encoder specialized for the strategy, table format and lc/lp/pb,
+ * once per block so that none of these are tested within the encoding loops */
+static LZMA2_chunkEncoder LZMA2_selectChunkEncoder(LZMA2_ECtx *const enc, const FL2_matchTable* const tbl)
 {
-    /* Template-like inline functions */
-    if (enc->strategy == FL2_fast) {
-        if (tbl->is_struct) {
-            return LZMA_encodeChunkFast(enc, block, tbl, 1,
-                pos, uncompressed_end);
-        }
-        else {
-            return LZMA_encodeChunkFast(enc, block, tbl, 0,
-                pos, uncompressed_end);
-        }
-    }
-    else {
-        if (tbl->is_struct) {
-            return LZMA_encodeChunkBest(enc, block, tbl, 1,
-                pos, uncompressed_end);
-        }
-        else {
-            return LZMA_encodeChunkBest(enc, block, tbl, 0,
-                pos, uncompressed_end);
-        }
-    }
+    if (enc->strategy != FL2_fast && tbl->format == RMF_TABLE_BITPACK
+        && LZMA_getLcLpPbCode(enc) == (2 * 5 + 0) * 9 + 3)
+        return LZMA2_encodeChunkBestBitpack_3_0_2;
+    return chunk_encoders[enc->strategy != FL2_fast][tbl->format];
 }
 
 size_t LZMA2_encode(LZMA2_ECtx *const enc,
     FL2_matchTable* const tbl,
     FL2_dataBlock const block,
+    BYTE* const dst,
     const FL2_lzma2Parameters* const options,
     int stream_prop,
-    FL2_atomic *const progress_in,
-    FL2_atomic *const progress_out,
+    FL2_atomic64 *const progress_in,
+    FL2_atomic64 *const progress_out,
     int *const canceled)
 {
     size_t const start = block.start;
+    BYTE* const out_base = (dst != NULL) ? dst : RMF_getTableAsOutputBuffer(tbl, start);
 
     /* Output starts in the temp buffer */
     BYTE* out_dest = enc->out_buf;
@@ -1968,9 +2062,13 @@ size_t LZMA2_encode(LZMA2_ECtx *const enc,
     enc->strategy = options->strategy;
     enc->fast_length = MIN(options->fast_length, kMatchLenMax);
     enc->match_cycles = MIN(options->match_cycles, kMatchesMax - 1);
+    enc->work_budget = options->work_budget;
 
     LZMA2_reset(enc, block.end);
 
+    LZMA2_chunkEncoder const encode_chunk = LZMA2_selectChunkEncoder(enc, tbl);
+    LZMA2_lcLpPb const lclppb = { enc->lc, enc->lit_pos_mask, enc->pos_mask };
+
     if (enc->strategy == FL2_ultra) {
         /* Create a hash chain to put the encoder into hybrid mode */
         if (enc->hash_alloc_3 < ((ptrdiff_t)1 << options->second_dict_bits)) {
@@ -1981,6 +2079,8 @@ size_t LZMA2_encode(LZMA2_ECtx *const enc,
             LZMA_hashReset(enc, options->second_dict_bits);
         }
         enc->hash_prev_index = (start >= (size_t)enc->hash_dict_3) ? (ptrdiff_t)(start - enc->hash_dict_3) : (ptrdiff_t)-1;
+        enc->hash_work = 0;
+        enc->hash_work_start = start;
     }
     enc->len_end_max = kOptimizerBufferSize - 1;
 
@@ -2005,19 +2105,19 @@ size_t LZMA2_encode(LZMA2_ECtx *const enc,
 
             if (pos == 0) {
                 /* First byte of the dictionary */
-                LZMA_encodeLiteral(enc, 0, block.data[0], 0);
+                LZMA_encodeLiteral(enc, lclppb, 0, block.data[0], 0);
                 ++cur;
             }
             if (pos == start) {
                 /* After kTempMinOutput bytes we can write data to the match table because the */
                 /* compressed data will never catch up with the table position being read. */
-                cur = LZMA2_encodeChunk(enc, tbl, block, cur, end);
+                cur = encode_chunk(enc, tbl, block, cur, end);
 
 				if (header_size + enc->rc.out_index > kTempBufferSize)
 					return FL2_ERROR(internal);
 
-                /* Switch to the match table as output buffer */
-                out_dest = RMF_getTableAsOutputBuffer(tbl, start);
+                /* Switch to the match table or dst as output buffer */
+                out_dest = out_base;
                 memcpy(out_dest, enc->out_buf, header_size + enc->rc.out_index);
                 enc->rc.out_buffer = out_dest + header_size;
 
@@ -2025,7 +2125,7 @@ size_t LZMA2_encode(LZMA2_ECtx *const enc,
                 enc->chunk_size = kChunkSize;
                 enc->chunk_limit = kMaxChunkCompressedSize - kMaxMatchEncodeSize * 2;
             }
-            next_index = LZMA2_encodeChunk(enc, tbl, block, cur, end);
+            next_index = encode_chunk(enc, tbl, block, cur, end);
             RC_flush(&enc->rc);
         }
         else {
@@ -2087,13 +2187,13 @@ size_t LZMA2_encode(LZMA2_ECtx *const enc,
         out_dest += compressed_size + header_size;
 
         /* Update progress concurrently with other encoder threads */
-        FL2_atomic_add(*progress_in, (long)(next_index - pos));
-        FL2_atomic_add(*progress_out, (long)(compressed_size + header_size));
+        FL2_atomic_add64(*progress_in, (long long)(next_index - pos));
+        FL2_atomic_add64(*progress_out, (long long)(compressed_size + header_size));
 
         pos = next_index;
 
         if (*canceled)
             return FL2_ERROR(canceled);
     }
-    return out_dest - RMF_getTableAsOutputBuffer(tbl, start);
+    return out_dest - out_base;
 }
@@ -19,7 +19,6 @@ extern "C" {
 #define kFastDistBits 12U
 
 #define LZMA2_END_MARKER '\0'
-#define ENC_MIN_BYTES_PER_THREAD 0x1C000 /* Enough for 8 threads, 1 Mb dict, 2/16 overlap */
 
 
 typedef struct LZMA2_ECtx_s LZMA2_ECtx;
@@ -34,6 +33,7 @@ typedef struct
     FL2_strategy strategy;
     unsigned second_dict_bits;
     unsigned reset_interval;
+    unsigned work_budget; /* limit the hash chain search to kHashWorkBudget per position */
 } FL2_lzma2Parameters;
 
 
@@ -43,19 +43,33 @@ void LZMA2_freeECtx(LZMA2_ECtx *const enc);
 
 int LZMA2_hashAlloc(LZMA2_ECtx *const enc, const FL2_lzma2Parameters* const options);
 
+void LZMA2_numaPlace(LZMA2_ECtx *const enc, const FL2_numa* const numa, unsigned const node);
+
+/* Encode the block into dst, or into the match table if dst is NULL, which overwrites it.
+ * dst needs LZMA2_encodeBound() of the block size, plus one for stream_prop. */
 size_t LZMA2_encode(LZMA2_ECtx *const enc,
     FL2_matchTable* const tbl,
     FL2_dataBlock const block,
+    BYTE* const dst,
     const FL2_lzma2Parameters* const options,
     int stream_prop,
-    FL2_atomic *const progress_in,
-    FL2_atomic *const progress_out,
+    FL2_atomic64 *const progress_in,
+    FL2_atomic64 *const progress_out,
     int *const canceled);
 
 BYTE LZMA2_getDictSizeProp(size_t const dictionary_size);
 
 size_t LZMA2_compressBound(size_t src_size);
 
+/* Capacity of dst needed by LZMA2_encode(), which exceeds the final output size by up to one
+ * compressed chunk while encoding */
+size_t LZMA2_encodeBound(size_t src_size);
+
+/* Reset the count of hash chain searches cut short by the work budget */
+void LZMA2_resetStats(LZMA2_ECtx *const enc);
+
+U64 LZMA2_degradedSearches(const LZMA2_ECtx *const enc);
+
 size_t LZMA2_encMemoryUsage(unsigned const chain_log, FL2_strategy const strategy, unsigned const thread_count);
 
 #if defined (__cplusplus)
@@ -9,6 +9,8 @@
 */
 
 #include <stdio.h>  
+#include <stdlib.h>     /* malloc, realloc, free */
+#include "count.h"
 
 #define MAX_READ_BEYOND_DEPTH 2
 
@@ -74,8 +76,21 @@ static size_t RMF_handleRepeat2(RMF_builder* const tbl, const BYTE* const data_b
     return rpt_index;
 }
 
+/* Link the positions of a repeat found by RMF_findRun() from pos up to end to the previous period */
+static void RMF_linkRun(FL2_matchTable* const tbl, RMF_run const* const run, size_t pos, size_t const end)
+{
+    size_t const period = run->period;
+    /* The length is exact because the repeat ends at run->end + RMF_RUN_TAIL */
+    size_t const run_end = run->end + RMF_RUN_TAIL;
+    size_t const max_end = (run_end > RADIX_MAX_LENGTH) ? MIN(end, run_end - RADIX_MAX_LENGTH) : 0;
+    for (; pos < max_end; ++pos)
+        SetMatchLinkAndLength(pos, pos - period, RADIX_MAX_LENGTH);
+    for (; pos < end; ++pos)
+        SetMatchLinkAndLength(pos, pos - period, (U32)(run_end - pos));
+}
+
 /* Initialization for the reference algortithm */
-#ifdef RMF_REFERENCE
+#if defined(RMF_REFERENCE) || defined(RMF_STRUCTURED)
 static void RMF_initReference(FL2_matchTable* const tbl, const void* const data, size_t const end)
 {
     const BYTE* const data_block = (const BYTE*)data;
@@ -104,8 +119,10 @@ static void RMF_initReference(FL2_matchTable* const tbl, const void* const data,
 #endif
 
 void
-#ifdef RMF_BITPACK
+#if defined(RMF_BITPACK)
 RMF_bitpackInit
+#elif defined(RMF_PACKED)
+RMF_packedInit
 #else
 RMF_structuredInit
 #endif
@@ -127,23 +144,68 @@ RMF_structuredInit
     SetNull(0);
 
     const BYTE* const data_block = (const BYTE*)data;
+    const BYTE* const radix24_map = tbl->radix24_count ? tbl->radix24_map : NULL;
     size_t st_index = 0;
     /* Initial 2-byte radix value */
     size_t radix_16 = ((size_t)data_block[0] << 8) | data_block[1];
-    tbl->stack[st_index++] = (U32)radix_16;
+    size_t const first_id = (radix24_map != NULL && radix24_map[radix_16] != RMF_RADIX24_NONE)
+        ? RMF_radix24Id(radix24_map[radix_16], data_block[2])
+        : radix_16;
+    tbl->stack[st_index++] = (U32)first_id;
+    tbl->list_heads[first_id].head = 0;
+    tbl->list_heads[first_id].count = 1;
     tbl->list_heads[radix_16].head = 0;
-    tbl->list_heads[radix_16].count = 1;
 
     radix_16 = ((size_t)((BYTE)radix_16) << 8) | data_block[2];
 
     ptrdiff_t i = 1;
     ptrdiff_t const block_size = end - 2;
+    ptrdiff_t const reuse_limit = (ptrdiff_t)tbl->reuse_limit;
+    RMF_run run;
+    run.start = end;
+    run.end = 0;
+    run.next = RMF_RUN_STRIDE;
+    if (tbl->params.link_runs)
+        RMF_findRun(&run, data_block, 0, end);
     for (; i < block_size; ++i) {
+        /* Repeats are linked directly. Only the first period and the tail go into the lists. */
+        while ((size_t)i >= run.start) {
+            RMF_linkRun(tbl, &run, i, run.end);
+            i = run.end;
+            RMF_findRun(&run, data_block, 0, end);
+            radix_16 = ((size_t)data_block[i] << 8) | data_block[i + 1];
+        }
         /* Pre-load the next value for speed increase on some hardware. Execution can continue while memory read is pending */
         size_t const next_radix = ((size_t)((BYTE)radix_16) << 8) | data_block[i + 2];
 
+        if (i < reuse_limit && RMF_isDominated(tbl, i)) {
+            SetNull(i);
+            radix_16 = next_radix;
+            continue;
+        }
         U32 const prev = tbl->list_heads[radix_16].head;
-        if (prev != RADIX_NULL_LINK) {
+        if (radix24_map != NULL && radix24_map[radix_16] != RMF_RADIX24_NONE) {
+            /* Link into the list of the 3-byte prefix. The first of the list gets the
+             * previous occurrence of the 2-byte prefix at length 2. */
+            size_t const id = RMF_radix24Id(radix24_map[radix_16], (BYTE)next_radix);
+            U32 const prev_24 = tbl->list_heads[id].head;
+            tbl->list_heads[radix_16].head = (U32)i;
+            if (prev_24 != RADIX_NULL_LINK) {
+                InitMatchLink(i, prev_24);
+                ++tbl->list_heads[id].count;
+            }
+            else {
+                if (prev != RADIX_NULL_LINK)
+                    SetMatchLinkAndLength(i, prev, 2);
+                else
+                    SetNull(i);
+                tbl->list_heads[id].count = 1;
+                tbl->stack[st_index++] = (U32)id;
+            }
+            tbl->list_heads[id].head = (U32)i;
+            radix_16 = next_radix;
+        }
+        else if (prev != RADIX_NULL_LINK) {
             /* Link this position to the previous occurrence */
             InitMatchLink(i, prev);
             /* Set the previous to this position */
@@ -168,6 +230,250 @@ RMF_structuredInit
     /* Never a match at the last byte */
     SetNull(end - 1);
 
+    RMF_clearRadix24Heads(tbl);
+
+    tbl->end_index = (U32)st_index;
+}
+
+/* Mark the positions in [start, end) which are the target of a link from a later position in
+ * the same range with a match of the maximum length. A list position beyond end can never be
+ * linked to one of these because the later one is nearer and matches at least as well.
+ * Positions within a repeat of period 1 or 2 are not marked because the repeat handlers assume
+ * that every position of the repeat is in the list.
+ */
+void
+#if defined(RMF_BITPACK)
+RMF_bitpackMarkOverlap
+#elif defined(RMF_PACKED)
+RMF_packedMarkOverlap
+#else
+RMF_structuredMarkOverlap
+#endif
+(FL2_matchTable* const tbl, const BYTE* const data_block, size_t const start, size_t const end)
+{
+    U32 const max_depth = MIN(MIN(tbl->params.depth, STRUCTURED_MAX_LENGTH) & ~1, RADIX_MAX_LENGTH);
+    BYTE* const map = tbl->reuse_map;
+
+    memset(map, 0, ((end - start) >> 3) + 1);
+    for (size_t pos = start; pos < end; ++pos) {
+        if (IsNull(pos) || GetMatchLength(pos) < max_depth)
+            continue;
+        size_t const link = GetMatchLink(pos);
+        if (link >= start && link + 2 < end
+            && data_block[link] != data_block[link + 2]
+            && (link < 2 || data_block[link - 2] != data_block[link]))
+        {
+            size_t const bit = link - start;
+            map[bit >> 3] |= (BYTE)(1U << (bit & 7));
+        }
+    }
+}
+
+/* Multi-threaded initialization, stage 1.
+ * Link the positions of one segment to previous occurrences within the segment only.
+ * The builder's stack is unused until the build begins, so it holds the segment's list heads
+ * and counts in its lower half, and the first position of each list and the order of first
+ * occurrence in its upper half.
+ */
+void
+#if defined(RMF_BITPACK)
+RMF_bitpackInitSegment
+#elif defined(RMF_PACKED)
+RMF_packedInitSegment
+#else
+RMF_structuredInitSegment
+#endif
+(FL2_matchTable* const tbl, const void* const data, size_t const start, size_t const end, size_t const block_end, size_t const job)
+{
+    RMF_builder* const builder = tbl->builders[job];
+    RMF_tableHead* const heads = builder->stack;
+    RMF_tableHead* const firsts = RMF_segmentFirsts(builder);
+    const BYTE* const data_block = (const BYTE*)data;
+    const BYTE* const radix24_map = tbl->radix24_count ? tbl->radix24_map : NULL;
+    size_t const list_ids = RADIX16_TABLE_SIZE + (tbl->radix24_count << 8);
+    size_t list_count = 0;
+
+    for (size_t i = 0; i < list_ids; i += 2) {
+        heads[i].head = RADIX_NULL_LINK;
+        heads[i + 1].head = RADIX_NULL_LINK;
+    }
+
+    /* Search from a little earlier for any repeat which reaches into the segment */
+    size_t const run_base = (start > RMF_RUN_LOOKBEHIND) ? (start - RMF_RUN_LOOKBEHIND) & ~(size_t)(RMF_RUN_STRIDE - 1) : 0;
+    RMF_run run;
+    run.start = end;
+    run.end = 0;
+    run.next = MAX(run_base, RMF_RUN_STRIDE);
+    if (tbl->params.link_runs) {
+        do {
+            RMF_findRun(&run, data_block, run_base, block_end);
+        } while (run.end <= start);
+    }
+
+    size_t radix_16 = ((size_t)data_block[start] << 8) | data_block[start + 1];
+    for (size_t i = start; i < end; ++i) {
+        if (i >= run.start) {
+            do {
+                size_t const run_end = MIN(run.end, end);
+                RMF_linkRun(tbl, &run, i, run_end);
+                i = run_end;
+                if (i == end)
+                    break;
+                RMF_findRun(&run, data_block, run_base, block_end);
+            } while (i >= run.start);
+            if (i == end)
+                break;
+            radix_16 = ((size_t)data_block[i] << 8) | data_block[i + 1];
+        }
+        size_t const next_radix = ((size_t)((BYTE)radix_16) << 8) | data_block[i + 2];
+
+        if (i < tbl->reuse_limit && RMF_isDominated(tbl, i)) {
+            SetNull(i);
+            radix_16 = next_radix;
+            continue;
+        }
+        U32 const prev = heads[radix_16].head;
+        if (radix24_map != NULL && radix24_map[radix_16] != RMF_RADIX24_NONE) {
+            size_t const id = RMF_radix24Id(radix24_map[radix_16], (BYTE)next_radix);
+            U32 const prev_24 = heads[id].head;
+            /* The first of the 2-byte prefix is kept for the finishing stage, but isn't a list */
+            if (prev == RADIX_NULL_LINK)
+                firsts[radix_16].head = (U32)i;
+            heads[radix_16].head = (U32)i;
+            if (prev_24 != RADIX_NULL_LINK) {
+                InitMatchLink(i, prev_24);
+                ++heads[id].count;
+            }
+            else {
+                if (prev != RADIX_NULL_LINK)
+                    SetMatchLinkAndLength(i, prev, 2);
+                else
+                    SetNull(i);
+                heads[id].count = 1;
+                firsts[id].head = (U32)i;
+                firsts[list_count++].count = (U32)id;
+            }
+            heads[id].head = (U32)i;
+        }
+        else if (prev != RADIX_NULL_LINK) {
+            InitMatchLink(i, prev);
+            heads[radix_16].head = (U32)i;
+            ++heads[radix_16].count;
+        }
+        else {
+            /* May be linked to a previous segment in the merge */
+            SetNull(i);
+            heads[radix_16].head = (U32)i;
+            heads[radix_16].count = 1;
+            firsts[radix_16].head = (U32)i;
+            firsts[list_count++].count = (U32)radix_16;
+        }
+        radix_16 = next_radix;
+    }
+    builder->segment_lists = list_count;
+}
+
+/* Multi-threaded initialization, stage 2.
+ * Link the first position of each list in a segment to the head of the same list in the
+ * nearest preceding segment, and sum the counts into the main head table.
+ * Each job handles a range of radix values. The count of every list except the earliest is
+ * zeroed so that stage 3 can reproduce the serial stack order.
+ */
+void
+#if defined(RMF_BITPACK)
+RMF_bitpackMergeSegments
+#elif defined(RMF_PACKED)
+RMF_packedMergeSegments
+#else
+RMF_structuredMergeSegments
+#endif
+(FL2_matchTable* const tbl, size_t const radix_start, size_t const radix_end)
+{
+    size_t const segment_count = tbl->segment_count;
+    for (size_t radix_16 = radix_start; radix_16 < radix_end; ++radix_16) {
+        /* A partitioned 2-byte prefix only needs its last head, and its firsts are handled in stage 3 */
+        int const partitioned = radix_16 < RADIX16_TABLE_SIZE
+            && tbl->radix24_count != 0
+            && tbl->radix24_map[radix_16] != RMF_RADIX24_NONE;
+        U32 head = RADIX_NULL_LINK;
+        U32 count = 0;
+        for (size_t seg = 0; seg < segment_count; ++seg) {
+            RMF_tableHead* const heads = tbl->builders[seg]->stack;
+            U32 const seg_head = heads[radix_16].head;
+            if (seg_head == RADIX_NULL_LINK)
+                continue;
+            if (partitioned) {
+                head = seg_head;
+                continue;
+            }
+            count += heads[radix_16].count;
+            if (head != RADIX_NULL_LINK) {
+                InitMatchLink(RMF_segmentFirsts(tbl->builders[seg])[radix_16].head, head);
+                heads[radix_16].count = 0;
+            }
+            head = seg_head;
+        }
+        tbl->list_heads[radix_16].head = head;
+        tbl->list_heads[radix_16].count = count;
+    }
+}
+
+/* Multi-threaded initialization, stage 3.
+ * Build the stack in order of first occurrence and handle the final positions.
+ */
+void
+#if defined(RMF_BITPACK)
+RMF_bitpackFinishSegments
+#elif defined(RMF_PACKED)
+RMF_packedFinishSegments
+#else
+RMF_structuredFinishSegments
+#endif
+(FL2_matchTable* const tbl, const void* const data, size_t const end)
+{
+    const BYTE* const data_block = (const BYTE*)data;
+    size_t st_index = 0;
+    for (size_t seg = 0; seg < tbl->segment_count; ++seg) {
+        const RMF_builder* const builder = tbl->builders[seg];
+        const RMF_tableHead* const heads = builder->stack;
+        const RMF_tableHead* const firsts = RMF_segmentFirsts(builder);
+        for (size_t i = 0; i < builder->segment_lists; ++i) {
+            U32 const radix_16 = firsts[i].count;
+            if (heads[radix_16].count != 0)
+                tbl->stack[st_index++] = radix_16;
+        }
+    }
+
+    /* The first of a partitioned 2-byte prefix in a segment gets the last occurrence in an
+     * earlier segment at length 2, unless the merge linked it into its list */
+    for (size_t i = 0; i < tbl->radix24_count; ++i) {
+        size_t const radix_16 = tbl->radix24_prefixes[i];
+        U32 head = RADIX_NULL_LINK;
+        for (size_t seg = 0; seg < tbl->segment_count; ++seg) {
+            const RMF_tableHead* const heads = tbl->builders[seg]->stack;
+            U32 const seg_head = heads[radix_16].head;
+            if (seg_head == RADIX_NULL_LINK)
+                continue;
+            U32 const first = RMF_segmentFirsts(tbl->builders[seg])[radix_16].head;
+            if (head != RADIX_NULL_LINK && IsNull(first))
+                SetMatchLinkAndLength(first, head, 2);
+            head = seg_head;
+        }
+    }
+
+    ptrdiff_t const block_size = end - 2;
+    size_t const radix_16 = ((size_t)data_block[block_size] << 8) | data_block[block_size + 1];
+    /* Handle the last value */
+    if (tbl->list_heads[radix_16].head != RADIX_NULL_LINK)
+        SetMatchLinkAndLength(block_size, tbl->list_heads[radix_16].head, 2);
+    else
+        SetNull(block_size);
+
+    /* Never a match at the last byte */
+    SetNull(end - 1);
+
+    RMF_clearRadix24Heads(tbl);
+
     tbl->end_index = (U32)st_index;
 }
 
@@ -185,8 +491,12 @@ static void RMF_recurseListsBuffered(RMF_builder* const tbl,
     if (orig_list_count < 2 || tbl->match_buffer_limit < 2)
         return;
 
+    ++tbl->stats.bufferedLists;
+    tbl->work += orig_list_count * RMF_WORK_COPY;
+
     /* Create an offset data buffer pointer for reading the next bytes */
     const BYTE* data_src = data_block + depth;
+    size_t const distance = tbl->prefetch_distance;
     size_t start = 0;
 
     do {
@@ -199,9 +509,25 @@ static void RMF_recurseListsBuffered(RMF_builder* const tbl,
         size_t prev_link = (size_t)-1;
         size_t rpt = 0;
         size_t rpt_tail = link;
+        /* Links are walked up to distance entries ahead of the current one, and the data
+         * for each is prefetched, so the data reads don't wait on the link chain */
+        size_t ring[RMF_PREFETCH_RING];
+        size_t ring_pos = 0;
+        size_t ahead = 0;
+        ring[0] = link;
         for (; count < list_count; ++count) {
+            ptrdiff_t const remaining = (ptrdiff_t)(start + orig_list_count - count) - 1;
+            size_t const target = MIN(distance, (size_t)MAX(remaining, 0));
+            while (ahead < target) {
+                size_t const ahead_link = GetMatchLink(ring[(ring_pos + ahead) & RMF_PREFETCH_MASK]);
+                ++ahead;
+                ring[(ring_pos + ahead) & RMF_PREFETCH_MASK] = ahead_link;
+                PREFETCH_L1(data_src + ahead_link);
+            }
             /* Pre-load next link */
-            size_t const next_link = GetMatchLink(link);
+            size_t const next_link = ahead ? ring[(ring_pos + 1) & RMF_PREFETCH_MASK] : GetMatchLink(link);
+            ++ring_pos;
+            ahead -= (ahead != 0);
             size_t dist = prev_link - link;
             if (dist > 2) {
                 /* Get 4 data characters for later. This doesn't block on a cache miss. */
@@ -245,6 +571,9 @@ static void RMF_recurseListsBuffered(RMF_builder* const tbl,
 
                     if (list_count > tbl->match_buffer_limit)
                         list_count = (U32)tbl->match_buffer_limit;
+                    /* The links read ahead may have been overwritten */
+                    ring[ring_pos & RMF_PREFETCH_MASK] = link;
+                    ahead = 0;
                 }
             }
         }
@@ -260,7 +589,7 @@ static void RMF_recurseListsBuffered(RMF_builder* const tbl,
         orig_list_count -= (U32)(list_count - start);
         /* Copy everything back, except the last link which never changes, and any extra overlap */
         count -= overlap + (overlap == 0);
-#ifdef RMF_BITPACK
+#if defined(RMF_BITPACK) || defined(RMF_PACKED)
         if (max_depth > RADIX_MAX_LENGTH) for (size_t pos = 0; pos < count; ++pos) {
             size_t const from = tbl->match_buffer[pos].from;
             if (from < block_start)
@@ -306,6 +635,7 @@ static void RMF_recurseListsBound(RMF_builder* const tbl,
     if (list_count < 2)
         return;
 
+    ++tbl->stats.boundLists;
     ptrdiff_t link = list_head->head;
     ptrdiff_t const bounded_size = max_depth + MAX_READ_BEYOND_DEPTH;
     ptrdiff_t const bounded_start = block_size - MIN(block_size, bounded_size);
@@ -438,10 +768,13 @@ static void RMF_bruteForce(RMF_builder* const tbl,
     U32 const max_depth)
 {
     const BYTE* data_src = data_block + depth;
-    size_t buffer[MAX_BRUTE_FORCE_LIST_SIZE + 1];
+    size_t buffer[MAX_BRUTE_FORCE_LIST_SIZE_LONG + 1];
     size_t const limit = max_depth - depth;
     size_t i = 1;
+    size_t compared = 0;
 
+    ++tbl->stats.bruteLists;
+    tbl->work += (list_count * (list_count - 1) >> 1) * RMF_WORK_PAIR;
     buffer[0] = link;
     /* Pre-load all locations */
     do {
@@ -457,10 +790,9 @@ static void RMF_bruteForce(RMF_builder* const tbl,
         const BYTE* const data = data_src + buffer[i];
         do {
             const BYTE* data_2 = data_src + buffer[j];
-            size_t len_test = 0;
-            while (data[len_test] == data_2[len_test] && len_test < limit)
-                ++len_test;
+            size_t const len_test = ZSTD_count(data, data_2, data + limit);
 
+            compared += len_test;
             if (len_test > longest) {
                 longest_index = j;
                 longest = len_test;
@@ -471,23 +803,28 @@ static void RMF_bruteForce(RMF_builder* const tbl,
 
         if (longest > 0)
             SetMatchLinkAndLength(buffer[i], (U32)buffer[longest_index], depth + (U32)longest);
+        else
+            /* A list from init has no lengths yet */
+            SetMatchLength(buffer[i], (U32)buffer[i + 1], depth);
 
         ++i;
     /* Test with block_start to avoid wasting time matching strings in the overlap region with each other */
     } while (i < list_count - 1 && buffer[i] >= block_start);
+    /* Only counted for the budget. The cost model must not see it, so the default output
+     * doesn't depend on whether a budget could be set. */
+    if (tbl->work_limit != (U64)-1)
+        tbl->work += compared >> RMF_WORK_BYTES_SHIFT;
 }
 
-/* RMF_recurseLists16() : 
- * Match strings at depth 2 using a 16-bit radix to lengthen to depth 4
+/* RMF_partitionLists16() :
+ * Match strings at depth 2 using a 16-bit radix to lengthen to depth 4.
+ * Returns the number of sub lists on the stack.
  */
-static void RMF_recurseLists16(RMF_builder* const tbl,
+static size_t RMF_partitionLists16(RMF_builder* const tbl,
     const BYTE* const data_block,
-    size_t const block_start,
     size_t link,
-    U32 count,
-    U32 const max_depth)
+    U32 count)
 {
-    U32 const table_max_depth = MIN(max_depth, RADIX_MAX_LENGTH);
     /* Offset data pointer. This function is only called at depth 2 */
     const BYTE* const data_src = data_block + 2;
     /* Load radix values from the data chars */
@@ -496,12 +833,31 @@ static void RMF_recurseLists16(RMF_builder* const tbl,
     size_t reset_list[RADIX8_TABLE_SIZE];
     size_t reset_count = 0;
     size_t st_index = 0;
+    /* The tail and radix of each sub list are kept in the upper half of the stack, so tails_16
+     * needs no reset. It holds an index for each radix, which is stale unless the tail at that
+     * index has the same radix. */
+    RMF_tableHead* const tails = tbl->stack + RADIX16_TABLE_SIZE;
+    ++tbl->stats.partitionLists;
+    tbl->work += count * RMF_WORK_PARTITION;
+    /* Walk the links ahead and prefetch their data, as in RMF_recurseListsBuffered() */
+    size_t ring[RMF_PREFETCH_RING];
+    size_t const last = (size_t)count - 1;
+    size_t loaded = 1;
+    size_t index = 0;
+    ring[0] = link;
     /* Last one is done separately */
     --count;
     do
     {
+        size_t const target = MIN(index + 1 + tbl->prefetch_distance, last);
+        while (loaded <= target) {
+            size_t const ahead_link = GetInitialMatchLink(ring[(loaded - 1) & RMF_PREFETCH_MASK]);
+            ring[loaded & RMF_PREFETCH_MASK] = ahead_link;
+            PREFETCH_L1(data_src + ahead_link);
+            ++loaded;
+        }
         /* Pre-load the next link */
-        size_t const next_link = GetInitialMatchLink(link);
+        size_t const next_link = ring[++index & RMF_PREFETCH_MASK];
         size_t const radix_8 = next_radix_8;
         size_t const radix_16 = next_radix_16;
         /* Initialization doesn't set lengths to 2 because it's a waste of time if buffering is used */
@@ -521,79 +877,104 @@ static void RMF_recurseLists16(RMF_builder* const tbl,
             reset_list[reset_count++] = radix_8;
         }
 
-        prev = tbl->tails_16[radix_16].prev_index;
-        tbl->tails_16[radix_16].prev_index = (U32)link;
-        if (prev != RADIX_NULL_LINK) {
-            ++tbl->tails_16[radix_16].list_count;
+        size_t const sub = tbl->tails_16[radix_16];
+        if (sub < st_index && tails[sub].count == radix_16) {
+            ++tbl->stack[sub].count;
             /* Link at length 4, overwriting the 3 */
-            SetMatchLinkAndLength(prev, (U32)link, 4);
+            SetMatchLinkAndLength(tails[sub].head, (U32)link, 4);
+            tails[sub].head = (U32)link;
         }
         else {
-            tbl->tails_16[radix_16].list_count = 1;
+            tbl->tails_16[radix_16] = (U16)st_index;
             tbl->stack[st_index].head = (U32)link;
-            /* Store a reference to this table location to retrieve the count at the end */
-            tbl->stack[st_index].count = (U32)radix_16;
+            tbl->stack[st_index].count = 1;
+            tails[st_index].head = (U32)link;
+            tails[st_index].count = (U32)radix_16;
             ++st_index;
         }
         link = next_link;
     } while (--count > 0);
 
     /* Do the last location */
-    U32 prev = tbl->tails_8[next_radix_8].prev_index;
+    U32 const prev = tbl->tails_8[next_radix_8].prev_index;
     if (prev != RADIX_NULL_LINK)
         SetMatchLinkAndLength(prev, (U32)link, 3);
 
-    prev = tbl->tails_16[next_radix_16].prev_index;
-    if (prev != RADIX_NULL_LINK) {
-        ++tbl->tails_16[next_radix_16].list_count;
-        SetMatchLinkAndLength(prev, (U32)link, 4);
+    size_t const sub = tbl->tails_16[next_radix_16];
+    if (sub < st_index && tails[sub].count == next_radix_16) {
+        ++tbl->stack[sub].count;
+        SetMatchLinkAndLength(tails[sub].head, (U32)link, 4);
     }
 
     for (size_t i = 0; i < reset_count; ++i)
         tbl->tails_8[reset_list[i]].prev_index = RADIX_NULL_LINK;
 
-    for (size_t i = 0; i < st_index; ++i) {
-        tbl->tails_16[tbl->stack[i].count].prev_index = RADIX_NULL_LINK;
-        tbl->stack[i].count = tbl->tails_16[tbl->stack[i].count].list_count;
+    return st_index;
+}
+
+/* Recurse one sub list produced by RMF_partitionLists16() */
+static void RMF_recurseSubList16(RMF_builder* const tbl,
+    const BYTE* const data_block,
+    size_t const block_start,
+    RMF_tableHead const sub_list,
+    U32 const max_depth,
+    size_t const stack_base)
+{
+    if (sub_list.count < 2) {
+        /* Nothing to do */
+        return;
     }
+    size_t const link = sub_list.head;
+    if (link < block_start)
+        return;
+    if (tbl->work > tbl->work_limit) {
+        /* Over budget. Leave the sub list linked at length 4. */
+        return;
+    }
+    if (stack_base > tbl->stack_size - RADIX16_TABLE_SIZE
+        && stack_base > tbl->stack_size - sub_list.count)
+    {
+        /* Potential stack overflow. Rare. */
+        return;
+    }
+    /* The current depth */
+    U32 const depth = GetMatchLength(link);
+    if (sub_list.count <= tbl->brute_limit) {
+        /* Quicker to use brute force, each string compared with all previous strings */
+        RMF_bruteForce(tbl, data_block,
+            block_start,
+            link,
+            sub_list.count,
+            depth,
+            MIN(max_depth, RADIX_MAX_LENGTH));
+        return;
+    }
+    /* Send to the buffer at depth 4 */
+    RMF_recurseListsBuffered(tbl,
+        data_block,
+        block_start,
+        link,
+        (BYTE)depth,
+        (BYTE)max_depth,
+        sub_list.count,
+        stack_base);
+}
+
+/* RMF_recurseLists16() : 
+ * Match strings at depth 2 using a 16-bit radix to lengthen to depth 4
+ */
+static void RMF_recurseLists16(RMF_builder* const tbl,
+    const BYTE* const data_block,
+    size_t const block_start,
+    size_t const link,
+    U32 const count,
+    U32 const max_depth)
+{
+    size_t st_index = RMF_partitionLists16(tbl, data_block, link, count);
 
     while (st_index > 0) {
         --st_index;
-        U32 const list_count = tbl->stack[st_index].count;
-        if (list_count < 2) {
-            /* Nothing to do */
-            continue;
-        }
-        link = tbl->stack[st_index].head;
-        if (link < block_start)
-            continue;
-        if (st_index > STACK_SIZE - RADIX16_TABLE_SIZE
-            && st_index > STACK_SIZE - list_count)
-        {
-            /* Potential stack overflow. Rare. */
-            continue;
-        }
-        /* The current depth */
-        U32 const depth = GetMatchLength(link);
-        if (list_count <= MAX_BRUTE_FORCE_LIST_SIZE) {
-            /* Quicker to use brute force, each string compared with all previous strings */
-            RMF_bruteForce(tbl, data_block,
-                block_start,
-                link,
-                list_count,
-                depth,
-                table_max_depth);
-            continue;
-        }
-        /* Send to the buffer at depth 4 */
-        RMF_recurseListsBuffered(tbl,
-            data_block,
-            block_start,
-            link,
-            (BYTE)depth,
-            (BYTE)max_depth,
-            list_count,
-            st_index);
+        RMF_recurseSubList16(tbl, data_block, block_start, tbl->stack[st_index], max_depth, st_index);
     }
 }
 
@@ -806,7 +1187,7 @@ static void RMF_recurseListsUnbuf16(RMF_builder* const tbl,
 }
 #endif
 
-#ifdef RMF_REFERENCE
+#if defined(RMF_REFERENCE) || defined(RMF_STRUCTURED)
 
 /* Simple, slow, complete parsing for reference */
 static void RMF_recurseListsReference(RMF_builder* const tbl,
@@ -851,8 +1232,8 @@ static void RMF_recurseListsReference(RMF_builder* const tbl,
             /* Nothing to do */
             continue;
         }
-        if (st_index > STACK_SIZE - RADIX8_TABLE_SIZE
-            && st_index > STACK_SIZE - list_count)
+        if (st_index > tbl->stack_size - RADIX8_TABLE_SIZE
+            && st_index > tbl->stack_size - list_count)
         {
             /* Potential stack overflow. Rare. */
             continue;
@@ -892,34 +1273,232 @@ static void RMF_recurseListsReference(RMF_builder* const tbl,
     }
 }
 
-#endif /* RMF_REFERENCE */
+#endif /* RMF_REFERENCE || RMF_STRUCTURED */
 
-/* Atomically take a list from the head table */
-static ptrdiff_t RMF_getNextList_mt(FL2_matchTable* const tbl)
+/* Take the next list from this builder's queue, or steal one from another builder's queue.
+ * Each queue holds lists in descending size order, so a thief always takes the largest list
+ * remaining in the victim's queue.
+ */
+static ptrdiff_t RMF_getNextList_mt(FL2_matchTable* const tbl, size_t const job)
 {
-    if (tbl->st_index < tbl->end_index) {
-        long pos = FL2_atomic_increment(tbl->st_index);
-        if (pos < tbl->end_index)
-            return pos;
+    if (tbl->st_index >= RADIX_CANCEL_INDEX)
+        return -1;
+
+    RMF_builder* const builder = tbl->builders[job];
+    if (builder->queue_index < builder->queue_end) {
+        long pos = FL2_atomic_increment(builder->queue_index);
+        if (pos < builder->queue_end) {
+            ++builder->stats.lists;
+            return builder->queue_start + pos;
+        }
+    }
+    size_t const queue_count = tbl->queue_count;
+    size_t victim = job;
+    for (size_t i = 1; i < queue_count; ++i) {
+        if (++victim >= queue_count)
+            victim = 0;
+        RMF_builder* const other = tbl->builders[victim];
+        if (other->queue_index < other->queue_end) {
+            long pos = FL2_atomic_increment(other->queue_index);
+            if (pos < other->queue_end) {
+                ++builder->stats.steals;
+                return other->queue_start + pos;
+            }
+        }
     }
     return -1;
 }
 
 /* Non-atomically take a list from the head table */
-static ptrdiff_t RMF_getNextList_st(FL2_matchTable* const tbl)
+static ptrdiff_t RMF_getNextList_st(FL2_matchTable* const tbl, size_t const job)
 {
+    (void)job;
     if (tbl->st_index < tbl->end_index) {
         long pos = FL2_nonAtomic_increment(tbl->st_index);
-        if (pos < tbl->end_index)
+        if (pos < tbl->end_index) {
+            ++tbl->builders[0]->stats.lists;
             return pos;
+        }
     }
     return -1;
 }
 
+/* Take a batch of sub lists from the list currently split. Returns the number taken. */
+static size_t RMF_takeSplitLists(FL2_matchTable* const tbl, size_t* const first)
+{
+    size_t taken = 0;
+    FL2_pthread_mutex_lock(&tbl->split_mutex);
+    if (tbl->split_state == RMF_SPLIT_ACTIVE && tbl->split_next < tbl->split_end) {
+        size_t i = tbl->split_next;
+        size_t total = 0;
+        *first = i;
+        do {
+            total += tbl->split_lists[i].count;
+            ++i;
+        } while (i < tbl->split_end && total < SPLIT_BATCH_SIZE);
+        taken = i - *first;
+        tbl->split_next = i;
+        ++tbl->split_pending;
+    }
+    FL2_pthread_mutex_unlock(&tbl->split_mutex);
+    return taken;
+}
+
+/* Process sub lists of the split list until none remain */
+static void RMF_recurseSplitLists(FL2_matchTable* const tbl,
+    RMF_builder* const builder,
+    FL2_dataBlock const block,
+    U32 const max_depth,
+    size_t const stack_base)
+{
+    size_t first;
+    size_t count;
+    while ((count = RMF_takeSplitLists(tbl, &first)) != 0) {
+        for (size_t i = first; i < first + count; ++i) {
+            RMF_tableHead const sub_list = tbl->split_lists[i];
+            /* Each sub list has its own budget, independent of the thread which takes it */
+            builder->work_limit = RMF_workLimit(builder, sub_list.count, max_depth, tbl->params.work_budget);
+            RMF_recurseSubList16(builder, block.data, block.start, sub_list, max_depth, stack_base);
+            builder->stats.degradedLists += builder->work > builder->work_limit;
+        }
+
+        FL2_pthread_mutex_lock(&tbl->split_mutex);
+        if (--tbl->split_pending == 0 && tbl->split_next >= tbl->split_end)
+            FL2_pthread_cond_broadcast(&tbl->split_cond);
+        FL2_pthread_mutex_unlock(&tbl->split_mutex);
+    }
+}
+
+/* Partition a very long list by the next 2 bytes and share the sub lists with the other builders.
+ * Only one list is split at a time. Returns 0 if another split is in progress.
+ */
+static int RMF_splitList(FL2_matchTable* const tbl,
+    size_t const job,
+    FL2_dataBlock const block,
+    RMF_tableHead const list_head,
+    U32 const max_depth)
+{
+    RMF_builder* const builder = tbl->builders[job];
+
+    FL2_pthread_mutex_lock(&tbl->split_mutex);
+    if (tbl->split_state != RMF_SPLIT_IDLE) {
+        FL2_pthread_mutex_unlock(&tbl->split_mutex);
+        return 0;
+    }
+    /* Builders which run out of lists wait for the sub lists */
+    tbl->split_state = RMF_SPLIT_PARTITION;
+    FL2_pthread_mutex_unlock(&tbl->split_mutex);
+
+    size_t const st_index = RMF_partitionLists16(builder, block.data, list_head.head, list_head.count);
+
+    DEBUGLOG(5, "RMF_splitList : thread %u, %u entries, %u sub lists", (U32)job, list_head.count, (U32)st_index);
+
+    FL2_pthread_mutex_lock(&tbl->split_mutex);
+    tbl->split_lists = builder->stack;
+    tbl->split_next = 0;
+    tbl->split_end = st_index;
+    tbl->split_pending = 0;
+    tbl->split_state = RMF_SPLIT_ACTIVE;
+    FL2_pthread_cond_broadcast(&tbl->split_cond);
+    FL2_pthread_mutex_unlock(&tbl->split_mutex);
+
+    /* The sub lists occupy the bottom of this builder's stack */
+    RMF_recurseSplitLists(tbl, builder, block, max_depth, st_index);
+
+    FL2_pthread_mutex_lock(&tbl->split_mutex);
+    while (tbl->split_pending != 0)
+        FL2_pthread_cond_wait(&tbl->split_cond, &tbl->split_mutex);
+    tbl->split_state = RMF_SPLIT_IDLE;
+    FL2_pthread_cond_broadcast(&tbl->split_cond);
+    FL2_pthread_mutex_unlock(&tbl->split_mutex);
+
+    ++builder->stats.splits;
+    return 1;
+}
+
+/* Wait while a list is being partitioned. Returns 1 if sub lists are available. */
+static int RMF_waitForSplit(FL2_matchTable* const tbl)
+{
+    FL2_pthread_mutex_lock(&tbl->split_mutex);
+    while (tbl->split_state == RMF_SPLIT_PARTITION)
+        FL2_pthread_cond_wait(&tbl->split_cond, &tbl->split_mutex);
+    int const available = tbl->split_state == RMF_SPLIT_ACTIVE && tbl->split_next < tbl->split_end;
+    FL2_pthread_mutex_unlock(&tbl->split_mutex);
+    return available;
+}
+
+/* Classify a list by its length, and by how many of a few positions share the next 1 or 4
+ * bytes with the first, which indicates the depth the recursion is likely to reach */
+static size_t RMF_costClass(const RMF_builder* const tbl, const BYTE* const data_block, size_t link, U32 const count)
+{
+    U32 const first = MEM_read32(data_block + link + 2);
+    size_t same_1 = 0;
+    size_t same_4 = 0;
+    for (size_t i = 1; i < RMF_COST_PROBE; ++i) {
+        link = GetMatchLink(link);
+        U32 const next = MEM_read32(data_block + link + 2);
+        same_1 += data_block[link + 2] == (BYTE)first;
+        same_4 += next == first;
+    }
+    size_t const depth_class = (same_4 * 2 >= RMF_COST_PROBE) ? 0 : (same_1 * 2 >= RMF_COST_PROBE) ? 1 : 2;
+    size_t const size_class = MIN(ZSTD_highbit32(count / RMF_COST_MIN_LIST), RMF_COST_SIZE_CLASSES - 1);
+    return size_class * RMF_COST_DEPTH_CLASSES + depth_class;
+}
+
+/* Choose the path with the lowest work per position, or the default if none has been taken in
+ * the class. Other paths are taken occasionally to learn their cost and in case the data has
+ * changed, chosen by a hash of the list head so the choice depends only on the list and the model. */
+static unsigned RMF_chooseCostPath(const FL2_matchTable* const tbl, RMF_builder* const builder, size_t const cost_class, size_t const head)
+{
+    const U32* const cost = tbl->cost.cost[cost_class];
+    U32 const hash = (U32)head * 2654435761U;
+    unsigned cheapest = RMF_COST_DEFAULT_PATH;
+    for (unsigned path = 0; path < RMF_COST_PATHS; ++path)
+        if (cost[path] != 0 && (cost[cheapest] == 0 || cost[path] < cost[cheapest]))
+            cheapest = path;
+    if ((hash >> 28) % RMF_COST_EXPLORE == RMF_COST_EXPLORE - 1) {
+        ++builder->stats.exploredLists;
+        return (cheapest + 1 + (hash >> 16) % (RMF_COST_PATHS - 1)) % RMF_COST_PATHS;
+    }
+    return cheapest;
+}
+
+/* Recurse a list by a path chosen by the cost model, and add the work done to the sums for the
+ * model. A single thread recurses the lists in a fixed order so it can update the model at once. */
+static void RMF_recurseCostedList(FL2_matchTable* const tbl,
+    RMF_builder* const builder,
+    unsigned const multi_thread,
+    const BYTE* const data_block,
+    size_t const block_start,
+    RMF_tableHead const list_head,
+    U32 const max_depth)
+{
+    size_t const cost_class = RMF_costClass(builder, data_block, list_head.head, list_head.count);
+    unsigned const path = RMF_chooseCostPath(tbl, builder, cost_class, list_head.head);
+    unsigned const cheapest_limit = builder->brute_limit;
+
+    ++builder->stats.modelLists;
+    builder->brute_limit = (path & RMF_COST_LONG_BRUTE) ? MAX_BRUTE_FORCE_LIST_SIZE_LONG : MAX_BRUTE_FORCE_LIST_SIZE;
+    U64 const work_start = builder->work;
+    if (path & RMF_COST_PARTITION)
+        RMF_recurseLists16(builder, data_block, block_start, list_head.head, list_head.count, max_depth);
+    else
+        RMF_recurseListsBuffered(builder, data_block, block_start, list_head.head, 2, (BYTE)max_depth, list_head.count, 0);
+    builder->brute_limit = cheapest_limit;
+
+    U64 const work = builder->work - work_start;
+    builder->cost_sums.work[cost_class][path] += work;
+    builder->cost_sums.positions[cost_class][path] += list_head.count;
+    if (!multi_thread)
+        RMF_updateCost(&tbl->cost.cost[cost_class][path], work, list_head.count);
+}
+
 /* Iterate the head table concurrently with other threads, and recurse each list until max_depth is reached */
 void
-#ifdef RMF_BITPACK
+#if defined(RMF_BITPACK)
 RMF_bitpackBuildTable
+#elif defined(RMF_PACKED)
+RMF_packedBuildTable
 #else
 RMF_structuredBuildTable
 #endif
@@ -935,24 +1514,40 @@ RMF_structuredBuildTable
     unsigned const max_depth = MIN(tbl->params.depth, STRUCTURED_MAX_LENGTH) & ~1;
     size_t bounded_start = max_depth + MAX_READ_BEYOND_DEPTH;
     bounded_start = block.end - MIN(block.end, bounded_start);
-    ptrdiff_t next_progress = (job == 0) ? 0 : RADIX16_TABLE_SIZE;
-    ptrdiff_t(*getNextList)(FL2_matchTable* const tbl)
+    RMF_builder* const builder = tbl->builders[job];
+    size_t const queue_count = multi_thread ? tbl->queue_count : 1;
+    unsigned progress_lists = 0;
+    ptrdiff_t(*getNextList)(FL2_matchTable* const tbl, size_t const job)
         = multi_thread ? RMF_getNextList_mt : RMF_getNextList_st;
+    /* Lists longer than this take too large a share of one thread's time */
+    U32 const split_threshold = (queue_count > 1)
+        ? (U32)MAX(block.end / (queue_count * SPLIT_LIST_FRACTION), SPLIT_LIST_MIN)
+        : RADIX_NULL_LINK;
 
     for (;;)
     {
+        /* Help with a split list before taking another */
+        if (tbl->split_state == RMF_SPLIT_ACTIVE && multi_thread)
+            RMF_recurseSplitLists(tbl, builder, block, max_depth, 0);
+
         /* Get the next to process */
-        ptrdiff_t pos = getNextList(tbl);
+        ptrdiff_t pos = getNextList(tbl, job);
 
-        if (pos < 0)
+        if (pos < 0) {
+            if (multi_thread && RMF_waitForSplit(tbl))
+                continue;
             break;
-
-        while (next_progress < pos) {
-            /* initial value of next_progress ensures only thread 0 executes this */
-            tbl->progress += tbl->list_heads[tbl->stack[next_progress]].count;
-            ++next_progress;
         }
+
         pos = tbl->stack[pos];
+        builder->progress += tbl->list_heads[pos].count;
+        if (job == 0 && (++progress_lists & 0x3F) == 0) {
+            /* Only thread 0 updates the total, and infrequently to avoid reading lines being written by other threads */
+            size_t progress = 0;
+            for (size_t i = 0; i < queue_count; ++i)
+                progress += tbl->builders[i]->progress;
+            tbl->progress = progress;
+        }
         RMF_tableHead list_head = tbl->list_heads[pos];
         tbl->list_heads[pos].head = RADIX_NULL_LINK;
         if (list_head.count < 2 || list_head.head < block.start)
@@ -969,20 +1564,263 @@ RMF_structuredBuildTable
             if (list_head.count < 2 || list_head.head < block.start)
                 continue;
         }
-        if (best && list_head.count > tbl->builders[job]->match_buffer_limit)
-        {
-            /* Not worth buffering or too long */
-            RMF_recurseLists16(tbl->builders[job], block.data, block.start, list_head.head, list_head.count, max_depth);
+        builder->buffer_sums.positions += list_head.count;
+        builder->work_limit = RMF_workLimit(builder, list_head.count, max_depth, tbl->params.work_budget);
+        if (list_head.count > builder->match_buffer_limit) {
+            UTIL_time_t const start = UTIL_getTime();
+            ++builder->stats.overflowLists;
+            builder->stats.overflowPositions += list_head.count;
+            builder->buffer_sums.overflow += list_head.count;
+            builder->buffer_sums.overflow_max = MAX(builder->buffer_sums.overflow_max, list_head.count);
+            if (list_head.count > split_threshold
+                && RMF_splitList(tbl, job, block, list_head, max_depth))
+            {
+                /* Done by all builders, which count their own degraded sub lists */
+            }
+            else {
+                if (best)
+                    /* Too long to buffer without losing matches at the chunk boundaries */
+                    RMF_recurseLists16(builder, block.data, block.start, list_head.head, list_head.count, max_depth);
+                else
+                    RMF_recurseListsBuffered(builder, block.data, block.start, list_head.head, 2, (BYTE)max_depth, list_head.count, 0);
+                builder->stats.degradedLists += builder->work > builder->work_limit;
+            }
+            builder->stats.overflowMicro += UTIL_clockSpanMicro(start);
+            continue;
+        }
+        builder->buffer_sums.largest = MAX(builder->buffer_sums.largest, list_head.count);
+        if (tbl->params.cost_model && list_head.count >= RMF_COST_MIN_LIST) {
+            RMF_recurseCostedList(tbl, builder, multi_thread, block.data, block.start, list_head, max_depth);
+        }
+        else if (list_head.count <= builder->brute_limit) {
+            RMF_bruteForce(builder, block.data, block.start, list_head.head, list_head.count, 2, MIN(max_depth, RADIX_MAX_LENGTH));
         }
         else {
-            RMF_recurseListsBuffered(tbl->builders[job], block.data, block.start, list_head.head, 2, (BYTE)max_depth, list_head.count, 0);
+            RMF_recurseListsBuffered(builder, block.data, block.start, list_head.head, 2, (BYTE)max_depth, list_head.count, 0);
+        }
+        builder->stats.degradedLists += builder->work > builder->work_limit;
+    }
+}
+
+#ifdef RMF_STRUCTURED
+
+/* Build a table of the block with the reference match finder, in one thread and to the
+ * table's full depth, for comparison with a table from the radix match finder */
+void RMF_structuredBuildReference(FL2_matchTable* const tbl, FL2_dataBlock const block)
+{
+    if (block.end <= 2) {
+        for (size_t i = 0; i < block.end; ++i)
+            SetNull(i);
+        return;
+    }
+    RMF_initReference(tbl, block.data, block.end);
+
+    unsigned const max_depth = MIN(tbl->params.depth, STRUCTURED_MAX_LENGTH) & ~1;
+    for (long i = 0; i < tbl->end_index; ++i) {
+        size_t const radix_16 = tbl->stack[i];
+        RMF_tableHead const list_head = tbl->list_heads[radix_16];
+        tbl->list_heads[radix_16].head = RADIX_NULL_LINK;
+        if (list_head.count < 2 || list_head.head < block.start)
+            continue;
+        RMF_recurseListsReference(tbl->builders[0], block.data, block.end, list_head.head, list_head.count, max_depth);
+    }
+}
+
+#endif /* RMF_STRUCTURED */
+
+typedef struct
+{
+    U32 pos;
+    U32 length; /* common prefix with the entry above, or with the current suffix for the top */
+} RMF_suffixEntry;
+
+/* Scan the suffix array in one direction and link each position in the block to the nearest
+ * earlier position on that side of it in suffix order, which has the longest common prefix of
+ * any earlier position on that side. The stack holds the earlier positions not yet passed by a
+ * smaller one. The forward scan sets every position. The reverse scan replaces a link if its
+ * match is longer after limiting to the table's maximum length, or as long and nearer.
+ * Returns 0, or 1 if out of memory. */
+static int RMF_suffixScan(FL2_matchTable* const tbl, FL2_dataBlock const block, const S32* const sa, const S32* const lcp, int const reverse)
+{
+    size_t const end = block.end;
+    size_t capacity = 1U << 12;
+    RMF_suffixEntry* stack = malloc(capacity * sizeof(RMF_suffixEntry));
+    if (stack == NULL)
+        return 1;
+    size_t sp = 0;
+    for (size_t i = 0; i < end; ++i) {
+        size_t const k = reverse ? end - 1 - i : i;
+        U32 const pos = (U32)sa[k];
+        /* Common prefix with the suffix before this one in the scan */
+        U32 length = (i == 0) ? 0 : (U32)lcp[k + reverse];
+        while (sp > 0 && stack[sp - 1].pos > pos) {
+            --sp;
+            if (sp > 0)
+                length = MIN(length, stack[sp - 1].length);
         }
+        if (pos >= block.start) {
+            if (sp > 0 && length >= 2) {
+                U32 const link = stack[sp - 1].pos;
+                U32 const capped = MIN(length, RADIX_MAX_LENGTH);
+                if (!reverse || IsNull(pos)
+                    || capped > GetMatchLength(pos)
+                    || (capped == GetMatchLength(pos) && link > GetMatchLink(pos)))
+                {
+                    SetMatchLinkAndLength(pos, link, capped);
+                }
+            }
+            else if (!reverse) {
+                SetNull(pos);
+            }
+        }
+        if (sp > 0)
+            stack[sp - 1].length = length;
+        if (sp == capacity) {
+            RMF_suffixEntry* const grown = realloc(stack, capacity * 2 * sizeof(RMF_suffixEntry));
+            if (grown == NULL) {
+                free(stack);
+                return 1;
+            }
+            stack = grown;
+            capacity *= 2;
+        }
+        stack[sp].pos = pos;
+        stack[sp].length = 0;
+        ++sp;
+    }
+    free(stack);
+    return 0;
+}
+
+/* Fill the table for the block from its suffix array, without the sentinel, and lcp, the prefix
+ * each suffix shares with the one before it in the array. Each position links to the longer match of its two neighbours in suffix order among the
+ * earlier positions, which is the longest match anywhere before it. Then, as in a radix build,
+ * positions sharing the search depth with earlier ones link to the nearest of them instead. The
+ * runs of suffixes which share the depth are numbered by position in runs, and sa is reused for
+ * the last position seen in each run. */
+int
+#if defined(RMF_BITPACK)
+RMF_bitpackSuffixLinks
+#elif defined(RMF_PACKED)
+RMF_packedSuffixLinks
+#else
+RMF_structuredSuffixLinks
+#endif
+(FL2_matchTable* const tbl, FL2_dataBlock const block, S32* const sa, const S32* const lcp, S32* const runs)
+{
+    if (RMF_suffixScan(tbl, block, sa, lcp, 0) != 0 || RMF_suffixScan(tbl, block, sa, lcp, 1) != 0)
+        return 1;
+
+    S32 const depth = (S32)MIN(tbl->params.depth, RADIX_MAX_LENGTH);
+    for (size_t k = 0; k < block.end; ++k) {
+        U32 const pos = (U32)sa[k];
+        if (pos < block.start || IsNull(pos))
+            continue;
+        S32 const length = (S32)GetMatchLength(pos);
+        if (length >= depth)
+            continue;
+        U32 best = GetMatchLink(pos);
+        S32 m = INT32_MAX;
+        for (size_t j = k; j > 0 && j + RMF_SUFFIX_WINDOW > k; --j) {
+            m = MIN(m, lcp[j]);
+            if (m < length)
+                break;
+            if ((U32)sa[j - 1] < pos && (U32)sa[j - 1] > best)
+                best = sa[j - 1];
+        }
+        m = INT32_MAX;
+        for (size_t j = k + 1; j < block.end && j < k + RMF_SUFFIX_WINDOW; ++j) {
+            m = MIN(m, lcp[j]);
+            if (m < length)
+                break;
+            if ((U32)sa[j] < pos && (U32)sa[j] > best)
+                best = sa[j];
+        }
+        if (best != GetMatchLink(pos))
+            SetMatchLinkAndLength(pos, best, (U32)length);
+    }
+    S32 run = -1;
+    for (size_t k = 0; k < block.end; ++k) {
+        run += (k == 0 || lcp[k] < depth);
+        runs[sa[k]] = run;
+    }
+    for (S32 i = 0; i <= run; ++i)
+        sa[i] = -1;
+    for (size_t pos = 0; pos < block.end; ++pos) {
+        S32 const prev = sa[runs[pos]];
+        if (prev >= 0 && pos >= block.start)
+            SetMatchLinkAndLength(pos, (U32)prev, (U32)depth);
+        sa[runs[pos]] = (S32)pos;
+    }
+    return 0;
+}
+
+/* Fill the table for the block by searching hash chains of 3-byte prefixes, up to cycles
+ * candidates per position. Positions without a 3-byte match take the nearest 2-byte match.
+ * heads_3 and heads_2 have 1 << hash_log entries and chain has one for each block position. */
+void
+#if defined(RMF_BITPACK)
+RMF_bitpackChainLinks
+#elif defined(RMF_PACKED)
+RMF_packedChainLinks
+#else
+RMF_structuredChainLinks
+#endif
+(FL2_matchTable* const tbl, FL2_dataBlock const block, U32* const heads_3, U32* const heads_2, U32* const chain, unsigned const hash_log, unsigned const cycles)
+{
+    const BYTE* const data = block.data;
+    size_t const end = block.end;
+    size_t const max_len = MIN(tbl->params.depth, RADIX_MAX_LENGTH);
+
+    memset(heads_3, 0xFF, sizeof(U32) << hash_log);
+    memset(heads_2, 0xFF, sizeof(U32) << hash_log);
+
+    size_t pos = 0;
+    for (; pos + 2 < end; ++pos) {
+        const BYTE* const src = data + pos;
+        U32 const h_3 = (((U32)src[0] | ((U32)src[1] << 8) | ((U32)src[2] << 16)) * 506832829U) >> (32 - hash_log);
+        U32 const h_2 = (((U32)src[0] | ((U32)src[1] << 8)) * 2654435761U) >> (32 - hash_log);
+        U32 link = heads_3[h_3];
+        U32 const link_2 = heads_2[h_2];
+        chain[pos] = link;
+        heads_3[h_3] = (U32)pos;
+        heads_2[h_2] = (U32)pos;
+        if (pos < block.start)
+            continue;
+
+        size_t const limit = MIN(end - pos, max_len);
+        size_t best_len = 1;
+        U32 best = RADIX_NULL_LINK;
+        for (unsigned n = cycles; n > 0 && link != RADIX_NULL_LINK; --n, link = chain[link]) {
+            /* Only a candidate matching the byte after the best so far can be longer */
+            if (data[link + best_len] != src[best_len])
+                continue;
+            size_t const len = ZSTD_count(src, data + link, src + limit);
+            if (len > best_len) {
+                best_len = len;
+                best = link;
+                if (len >= limit)
+                    break;
+            }
+        }
+        if (best_len < 2 && link_2 != RADIX_NULL_LINK && MEM_read16(data + link_2) == MEM_read16(src)) {
+            best_len = 2;
+            best = link_2;
+        }
+        if (best_len >= 2)
+            SetMatchLinkAndLength(pos, best, (U32)best_len);
+        else
+            SetNull(pos);
     }
+    for (pos = MAX(pos, block.start); pos < end; ++pos)
+        SetNull(pos);
 }
 
 int
-#ifdef RMF_BITPACK
+#if defined(RMF_BITPACK)
 RMF_bitpackIntegrityCheck
+#elif defined(RMF_PACKED)
+RMF_packedIntegrityCheck
 #else
 RMF_structuredIntegrityCheck
 #endif
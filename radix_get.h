@@ -42,16 +42,15 @@ static size_t RMF_bitpackExtendMatch(const BYTE* const data,
         return limit - start_index;
     }
 
-    while (end_index < limit && data[end_index - dist] == data[end_index])
-        ++end_index;
+    end_index += ZSTD_count(data + end_index, data + end_index - dist, data + limit);
 
     DEBUGLOG(7, "RMF_bitpackExtendMatch : pos %u, link %u, init length %u, full length %u", (U32)start_index, link, (U32)length, (U32)(end_index - start_index));
     return end_index - start_index;
 }
 
-#define GetMatchLink(table, pos) ((const RMF_unit*)(table))[(pos) >> UNIT_BITS].links[(pos) & UNIT_MASK]
+#define GetMatchLink(table, pos) ((const RMF_unit*)RMF_unitTable(table))[UNIT_INDEX(pos)].links[UNIT_SLOT(pos)]
 
-#define GetMatchLength(table, pos) ((const RMF_unit*)(table))[(pos) >> UNIT_BITS].lengths[(pos) & UNIT_MASK]
+#define GetMatchLength(table, pos) ((const RMF_unit*)RMF_unitTable(table))[UNIT_INDEX(pos)].lengths[UNIT_SLOT(pos)]
 
 static size_t RMF_structuredExtendMatch(const BYTE* const data,
     const U32* const table,
@@ -74,21 +73,47 @@ static size_t RMF_structuredExtendMatch(const BYTE* const data,
         return limit - start_index;
     }
 
-    while (end_index < limit && data[end_index - dist] == data[end_index])
-        ++end_index;
+    end_index += ZSTD_count(data + end_index, data + end_index - dist, data + limit);
 
     DEBUGLOG(7, "RMF_structuredExtendMatch : pos %u, link %u, init length %u, full length %u", (U32)start_index, link, (U32)length, (U32)(end_index - start_index));
     return end_index - start_index;
 }
 
+static size_t RMF_packedExtendMatch(const BYTE* const data,
+    const U32* const table,
+    ptrdiff_t const start_index,
+    ptrdiff_t limit,
+    U32 const link,
+    size_t const length)
+{
+    ptrdiff_t end_index = start_index + length;
+    ptrdiff_t const dist = start_index - link;
+
+    if (limit > start_index + (ptrdiff_t)kMatchLenMax)
+        limit = start_index + kMatchLenMax;
+
+    while (end_index < limit && end_index - (ptrdiff_t)RMF_packedGetLink(table, end_index) == dist)
+        end_index += RMF_packedGetLength(table, end_index);
+
+    if (end_index >= limit) {
+        DEBUGLOG(7, "RMF_packedExtendMatch : pos %u, link %u, init length %u, full length %u", (U32)start_index, link, (U32)length, (U32)(limit - start_index));
+        return limit - start_index;
+    }
+
+    end_index += ZSTD_count(data + end_index, data + end_index - dist, data + limit);
+
+    DEBUGLOG(7, "RMF_packedExtendMatch : pos %u, link %u, init length %u, full length %u", (U32)start_index, link, (U32)length, (U32)(end_index - start_index));
+    return end_index - start_index;
+}
+
 FORCE_INLINE_TEMPLATE
 RMF_match RMF_getMatch(FL2_dataBlock block,
     FL2_matchTable* tbl,
     unsigned max_depth,
-    int structTbl,
+    int tblFormat,
     size_t pos)
 {
-    if (structTbl)
+    if (tblFormat == RMF_TABLE_STRUCTURED)
     {
         U32 const link = GetMatchLink(tbl->table, pos);
 
@@ -110,6 +135,28 @@ RMF_match RMF_getMatch(FL2_dataBlock block,
 
         return match;
     }
+    else if (tblFormat == RMF_TABLE_PACKED)
+    {
+        U32 const link = RMF_packedGetLink(tbl->table, pos);
+
+        RMF_match match;
+        match.length = 0;
+
+        if (link == PACKED_NULL_LINK)
+            return match;
+
+        size_t const length = RMF_packedGetLength(tbl->table, pos);
+        size_t const dist = pos - link - 1;
+
+        if (length == max_depth || length == PACKED_MAX_LENGTH /* from HandleRepeat */)
+            match.length = (U32)RMF_packedExtendMatch(block.data, tbl->table, pos, block.end, link, length);
+        else
+            match.length = (U32)length;
+
+        match.dist = (U32)dist;
+
+        return match;
+    }
     else {
         U32 link = tbl->table[pos];
 
@@ -138,10 +185,10 @@ FORCE_INLINE_TEMPLATE
 RMF_match RMF_getNextMatch(FL2_dataBlock block,
     FL2_matchTable* tbl,
     unsigned max_depth,
-    int structTbl,
+    int tblFormat,
     size_t pos)
 {
-    if (structTbl)
+    if (tblFormat == RMF_TABLE_STRUCTURED)
     {
         U32 const link = GetMatchLink(tbl->table, pos);
 
@@ -167,6 +214,32 @@ RMF_match RMF_getNextMatch(FL2_dataBlock block,
 
         return match;
     }
+    else if (tblFormat == RMF_TABLE_PACKED)
+    {
+        U32 const link = RMF_packedGetLink(tbl->table, pos);
+
+        RMF_match match;
+        match.length = 0;
+
+        if (link == PACKED_NULL_LINK)
+            return match;
+
+        size_t const length = RMF_packedGetLength(tbl->table, pos);
+        size_t const dist = pos - link - 1;
+
+        /* same distance, one byte shorter */
+        if (link - 1 == RMF_packedGetLink(tbl->table, pos - 1))
+            return match;
+
+        if (length == max_depth || length == PACKED_MAX_LENGTH /* from HandleRepeat */)
+            match.length = (U32)RMF_packedExtendMatch(block.data, tbl->table, pos, block.end, link, length);
+        else
+            match.length = (U32)length;
+
+        match.dist = (U32)dist;
+
+        return match;
+    }
     else {
         U32 link = tbl->table[pos];
 
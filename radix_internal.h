@@ -12,6 +12,9 @@
 #define RADIX_INTERNAL_H
 
 #include "atomic.h"
+#include "fl2_threading.h"
+#include "platform.h"
+#include "util.h"
 #include "radix_mf.h"
 
 #if defined(FL2_XZ_BUILD) && defined(TUKLIB_FAST_UNALIGNED_ACCESS)
@@ -23,29 +26,128 @@ extern "C" {
 #endif
 
 #define DICTIONARY_LOG_MIN 12U
-#define DICTIONARY_LOG_MAX_64 30U
+#define DICTIONARY_LOG_MAX_64 32U
 #define DICTIONARY_LOG_MAX_32 27U
 #define DICTIONARY_SIZE_MIN ((size_t)1 << DICTIONARY_LOG_MIN)
-#define DICTIONARY_SIZE_MAX_64 ((size_t)1 << DICTIONARY_LOG_MAX_64)
+#define DICTIONARY_SIZE_MAX_64 ((size_t)0xFFFFFFFCU) /* positions and links stay below RADIX_NULL_LINK */
 #define DICTIONARY_SIZE_MAX_32 ((size_t)1 << DICTIONARY_LOG_MAX_32)
 #define MAX_REPEAT 24
 #define RADIX16_TABLE_SIZE ((size_t)1 << 16)
 #define RADIX8_TABLE_SIZE ((size_t)1 << 8)
-#define STACK_SIZE (RADIX16_TABLE_SIZE * 3)
+#define STACK_SIZE (RADIX16_TABLE_SIZE * 2) /* the sub lists of a 2-byte partition and their tails */
 #define MAX_BRUTE_FORCE_LIST_SIZE 5
+#define MAX_BRUTE_FORCE_LIST_SIZE_LONG 10 /* alternative limit tried by the cost model */
 #define BUFFER_LINK_MASK 0xFFFFFFU
 #define MATCH_BUFFER_OVERLAP 6
 #define BITPACK_MAX_LENGTH 63U
 #define STRUCTURED_MAX_LENGTH 255U
+#define PACKED_MAX_LENGTH 15U
 
 #define RADIX_LINK_BITS 26
 #define RADIX_LINK_MASK ((1U << RADIX_LINK_BITS) - 1)
 #define RADIX_NULL_LINK 0xFFFFFFFFU
 
-#define UNIT_BITS 2
-#define UNIT_MASK ((1U << UNIT_BITS) - 1)
+/* A structured unit holds 4 positions in 20 bytes and is indexed with shifts. Define
+ * FL2_STRUCTURED_UNIT_64 to use a unit of 12 positions padded to a 64-byte cache line, so each
+ * position touches a single line. It is about 7% larger and showed no measured speed gain. */
+#ifdef FL2_STRUCTURED_UNIT_64
+#  define UNIT_POSITIONS 12U
+#  define UNIT_ALIGN 64U
+#else
+#  define UNIT_POSITIONS 4U
+#  define UNIT_ALIGN 4U
+#endif
+#define UNIT_INDEX(pos) ((size_t)(pos) / UNIT_POSITIONS)
+#define UNIT_SLOT(pos) ((size_t)(pos) % UNIT_POSITIONS)
+
+#define PACKED_LINK_BITS 24
+#define PACKED_NULL_LINK 0xFFFFFFU
+
+/* Table formats. Packed is the smallest, then bitpack, then structured. */
+#define RMF_TABLE_BITPACK 0
+#define RMF_TABLE_STRUCTURED 1
+#define RMF_TABLE_PACKED 2
+
+#define RMF_PREFETCH_RING 32 /* power of 2 above FL2_PREFETCH_DISTANCE_MAX + 1 */
+#define RMF_PREFETCH_MASK (RMF_PREFETCH_RING - 1)
+
+/* Repeats of a short period are found in init by testing a window at intervals. The positions
+ * after the first period are linked directly and kept out of the lists, except for a short tail
+ * which must stay below the threshold of the repeat handlers in the builder. */
+#define RMF_RUN_PERIOD_MAX 8
+#define RMF_RUN_WINDOW 16 /* at least 2 * RMF_RUN_PERIOD_MAX so only the smallest period matches */
+#define RMF_RUN_STRIDE 64
+#define RMF_RUN_MIN 128 /* shortest repeat linked in init */
+#define RMF_RUN_TAIL 8 /* positions left in the lists at the end of a repeat, less than MAX_REPEAT / 2 - 1 */
+#define RMF_RUN_LOOKBEHIND (RMF_RUN_MIN + 2 * RMF_RUN_STRIDE) /* finds any repeat reaching a segment start */
+
+/* In blocks of at least RMF_RADIX24_MIN_BLOCK bytes, the lists of the most frequent 2-byte prefixes
+ * are partitioned by the third byte in init, which saves a level of recursion over the longest
+ * lists. A full 24-bit head table would need 16M heads, so only the prefixes estimated from a
+ * sample of the block to have RMF_RADIX24_MIN_COUNT positions or more are partitioned. Their
+ * lists take the ids after the 2-byte prefixes. */
+#define RMF_RADIX24_MIN_BLOCK ((size_t)1 << 26)
+#define RMF_RADIX24_PREFIXES 128 /* the heads and firsts of all list ids fill a builder's stack in a segmented init */
+#define RMF_RADIX24_MIN_COUNT 16384U
+#define RMF_RADIX24_SAMPLE 61 /* interval of the positions counted to choose the prefixes */
+#define RMF_RADIX24_NONE 0xFF
+#define RMF_LIST_IDS (RADIX16_TABLE_SIZE + RMF_RADIX24_PREFIXES * RADIX8_TABLE_SIZE)
+
+/* The cost model, enabled by FL2_p_costModel, chooses the recursion path of each list of moderate
+ * length, and learns the work per position of each path for each class of list from the work
+ * done on earlier lists. Paths combine the choice of buffered or partitioned recursion with the choice of brute force limit.
+ * Work is counted in units weighted by the relative time of each operation rather than timed,
+ * because the paths can give slightly different tables and the output must not depend on timing.
+ * The brute force limit changes which of the equal length matches are found, so the output is
+ * within a few dozen bytes per megabyte of a fixed path, in either direction. */
+#define RMF_COST_MIN_LIST 1024U /* shorter lists go straight to the path the model prefers */
+#define RMF_COST_SIZE_CLASSES 8 /* by the log2 of count / RMF_COST_MIN_LIST */
+#define RMF_COST_DEPTH_CLASSES 3 /* by how many sampled positions share the next bytes */
+#define RMF_COST_CLASSES (RMF_COST_SIZE_CLASSES * RMF_COST_DEPTH_CLASSES)
+#define RMF_COST_PARTITION 1 /* path flag: partition by 2 more bytes before buffering */
+#define RMF_COST_LONG_BRUTE 2 /* path flag: brute force up to MAX_BRUTE_FORCE_LIST_SIZE_LONG */
+#define RMF_COST_PATHS 4
+#define RMF_COST_DEFAULT_PATH RMF_COST_LONG_BRUTE /* usually the cheapest */
+#define RMF_COST_PROBE 8 /* positions sampled to classify a list */
+#define RMF_COST_EXPLORE 16 /* about one list in this many takes a path other than the cheapest */
+#define RMF_WORK_COPY 4 /* position copied into the match buffer, with a random data read */
+#define RMF_WORK_PARTITION 6 /* position partitioned by 2 bytes in the table */
+#define RMF_WORK_LEVEL 1 /* position sorted by one byte in the match buffer */
+#define RMF_WORK_PAIR 2 /* pair of positions compared by brute force */
+#define RMF_WORK_BYTES_SHIFT 3 /* 8 bytes compared by brute force beyond the first */
 
-#define RADIX_CANCEL_INDEX (long)(RADIX16_TABLE_SIZE + FL2_MAXTHREADS + 2)
+/* With the work budget enabled, each list may take this much work per position, plus the base
+ * amount, before the rest of it is left at the lengths already found. This bounds the time per
+ * byte on inputs which make the recursion reach the full depth with little progress. Most lists
+ * take far less, but long lists of repetitive text can exceed it, so the budget is opt-in. */
+#define RMF_WORK_BUDGET(max_depth) ((U64)(max_depth) / 4 + 64)
+#define RMF_WORK_BUDGET_BASE (1U << 16)
+#define RMF_workLimit(builder, count, max_depth, budget) \
+    ((budget) ? (builder)->work + (U64)(count) * RMF_WORK_BUDGET(max_depth) + RMF_WORK_BUDGET_BASE : (U64)-1)
+
+#define RMF_SPLIT_IDLE 0
+#define RMF_SPLIT_PARTITION 1
+#define RMF_SPLIT_ACTIVE 2
+#define SPLIT_LIST_MIN RADIX16_TABLE_SIZE /* never split lists shorter than this */
+#define SPLIT_LIST_FRACTION 2 /* split lists longer than this fraction of each thread's share of the block */
+#define SPLIT_BATCH_SIZE (1U << 12) /* minimum total count of the sub lists taken at once */
+
+/* Overlap position found to be unreachable by the previous block's build */
+#define RMF_isDominated(tbl, pos) (((tbl)->reuse_map[((pos) + (tbl)->reuse_offset) >> 3] >> (((pos) + (tbl)->reuse_offset) & 7)) & 1)
+
+/* The suffix array match finder sorts blocks of up to this size, with signed 32-bit positions
+ * and a sentinel */
+#define RMF_SUFFIX_MAX ((size_t)0x7FFFFFFE)
+#define RMF_SUFFIX_WINDOW 64 /* suffixes searched on each side for a nearer match of the same length */
+
+/* The hash chain match finder for small blocks has up to 1 << RMF_CHAIN_HASH_LOG_MAX heads for each
+ * prefix length, and searches a number of candidates per position which scales with the depth */
+#define RMF_CHAIN_MAX ((size_t)1 << 24) /* within the link range of every table format */
+#define RMF_CHAIN_HASH_LOG_MIN 8
+#define RMF_CHAIN_HASH_LOG_MAX 16
+#define RMF_CHAIN_CYCLES(depth) ((depth) / 4U + 2U)
+
+#define RADIX_CANCEL_INDEX (long)(RMF_LIST_IDS + FL2_MAXTHREADS + 2)
 
 typedef struct
 {
@@ -58,6 +160,14 @@ union src_data_u {
     U32 u32;
 };
 
+typedef struct
+{
+    size_t start;   /* first position linked to the previous period */
+    size_t end;     /* end of the linked positions */
+    size_t period;
+    size_t next;    /* next position to test */
+} RMF_run;
+
 typedef struct
 {
     U32 from;
@@ -73,40 +183,187 @@ typedef struct
 
 typedef struct
 {
-    U32 links[1 << UNIT_BITS];
-    BYTE lengths[1 << UNIT_BITS];
+    U32 links[UNIT_POSITIONS];
+    BYTE lengths[UNIT_POSITIONS];
+#if UNIT_ALIGN > 4
+    BYTE padding[UNIT_ALIGN - UNIT_POSITIONS * 5];
+#endif
 } RMF_unit;
 
+/* The structured units start at the first UNIT_ALIGN boundary in the table */
+#if UNIT_ALIGN > 4
+#  define RMF_unitTable(table) ((RMF_unit*)(((size_t)(table) + UNIT_ALIGN - 1) & ~(size_t)(UNIT_ALIGN - 1)))
+#else
+#  define RMF_unitTable(table) ((RMF_unit*)(table))
+#endif
+
+/* Two positions with 24-bit links and 4-bit lengths, 3.5 bytes per position.
+ * The lengths share a byte, so only one thread may write the table. */
+typedef struct
+{
+    BYTE links[2][3];
+    BYTE lengths;
+} RMF_packedUnit;
+
+MEM_STATIC U32 RMF_packedGetLink(const U32* const table, size_t const pos)
+{
+    return MEM_readLE24(((const RMF_packedUnit*)table)[pos >> 1].links[pos & 1]);
+}
+
+MEM_STATIC U32 RMF_packedGetLength(const U32* const table, size_t const pos)
+{
+    return (((const RMF_packedUnit*)table)[pos >> 1].lengths >> ((pos & 1) << 2)) & PACKED_MAX_LENGTH;
+}
+
+MEM_STATIC void RMF_packedSetLink(U32* const table, size_t const pos, U32 const link)
+{
+    MEM_writeLE24(((RMF_packedUnit*)table)[pos >> 1].links[pos & 1], link);
+}
+
+MEM_STATIC void RMF_packedSetLength(U32* const table, size_t const pos, U32 const length)
+{
+    BYTE* const lengths = &((RMF_packedUnit*)table)[pos >> 1].lengths;
+    unsigned const shift = (unsigned)(pos & 1) << 2;
+    *lengths = (BYTE)((*lengths & ~(PACKED_MAX_LENGTH << shift)) | (length << shift));
+}
+
+/* Read by all builders and updated between builds, so the path of each list depends only on
+ * the list and the blocks already built, and not on which thread recursed which lists */
+typedef struct
+{
+    U32 cost[RMF_COST_CLASSES][RMF_COST_PATHS]; /* moving average of 1/16 work units per position, 0 if untried */
+    unsigned brute_limit; /* for lists too short to classify */
+} RMF_costModel;
+
+/* Work done by one builder in the current build, by the class of list and the path taken */
+typedef struct
+{
+    U64 work[RMF_COST_CLASSES][RMF_COST_PATHS];
+    U64 positions[RMF_COST_CLASSES][RMF_COST_PATHS];
+} RMF_costSums;
+
+/* Use of the match buffer by one builder in the current build, for tuning its size */
+typedef struct
+{
+    U64 positions;      /* in all lists taken */
+    U64 overflow;       /* in lists too long for the buffer */
+    size_t overflow_max; /* longest of those */
+    size_t largest;     /* longest list which fit */
+} RMF_bufferSums;
+
 typedef struct
 {
     unsigned max_len;
+    unsigned prefetch_distance;
+    unsigned brute_limit;   /* lists up to this count are brute forced */
+    U64 work;               /* weighted count of operations in the current block */
+    U64 work_limit;         /* the current list degrades when work passes this */
     U32* table;
     size_t match_buffer_size;
     size_t match_buffer_limit;
+    size_t segment_lists;
+    FL2_atomic queue_index; /* next list in this builder's queue, also advanced by other builders when stealing */
+    long queue_end;
+    size_t queue_start;
+    size_t progress;
+    FL2_builderStats stats;
+    RMF_costSums cost_sums;
+    RMF_bufferSums buffer_sums;
+    UTIL_time_t start_time;
+    UTIL_time_t end_time;
+    RMF_tableHead* stack;   /* follows the match buffer */
+    size_t stack_size;
     RMF_listTail tails_8[RADIX8_TABLE_SIZE];
-    RMF_tableHead stack[STACK_SIZE];
-    RMF_listTail tails_16[RADIX16_TABLE_SIZE];
+    U16 tails_16[RADIX16_TABLE_SIZE]; /* stack index of each 2-byte sub list, valid if its tail has the radix */
     RMF_buildMatch match_buffer[1];
 } RMF_builder;
 
+/* The builders of a segmented init keep the heads of their segment at the bottom of the stack
+ * and the first position of each list above them */
+#define RMF_segmentFirsts(builder) ((builder)->stack + ((builder)->stack_size >> 1))
+
 struct FL2_matchTable_s
 {
     FL2_atomic st_index;
     long end_index;
-    int is_struct;
-    int alloc_struct;
+    int format;
+    int alloc_format;
+    unsigned alloc_pages;
     unsigned thread_count;
     size_t unreduced_dict_size;
     size_t progress;
+    size_t segment_count;
+    size_t segment_size;
+    size_t queue_count;
+    FL2_pthread_mutex_t split_mutex;
+    FL2_pthread_cond_t split_cond;
+    volatile int split_state;
+    const RMF_tableHead* split_lists; /* sub lists on the splitting builder's stack */
+    size_t split_next;
+    size_t split_end;
+    unsigned split_pending; /* batches taken and not yet completed */
+    BYTE* reuse_map;        /* bit set for each overlap position with a nearer full-depth match */
+    size_t reuse_map_size;
+    size_t reuse_start;     /* previous block positions covered by reuse_map */
+    size_t reuse_end;
+    size_t reuse_offset;    /* current block position + offset = reuse_map bit */
+    size_t reuse_limit;     /* positions below this are checked against reuse_map in init */
+    unsigned reuse_depth;   /* depth of the build which marked reuse_map */
+    unsigned depth_limit;   /* depth set by the caller, the upper bound of an adaptive depth */
+    unsigned next_depth;    /* depth chosen by RMF_adaptDepth() for the next block, or 0 */
+    int heads_ready;        /* list_heads are initialized, which waits for the first radix build */
+    int alt_built;          /* the current table was built by RMF_buildSuffixTable() or RMF_buildChainTable() */
+    S32* alt_buf;           /* suffix array and LCP, or hash chains, of the block, kept for the next block */
+    size_t alt_size;        /* values alt_buf can hold */
     RMF_parameters params;
     RMF_builder** builders;
-    U32 stack[RADIX16_TABLE_SIZE];
-    RMF_tableHead list_heads[RADIX16_TABLE_SIZE];
+    const FL2_numa* numa;     /* placement of the builders, reapplied if they are resized */
+    FL2_matchQuality quality; /* accumulated by RMF_analyzeMatches() */
+    RMF_costModel cost;       /* updated by RMF_accumulateStats() */
+    size_t radix24_count;     /* 2-byte prefixes partitioned by the third byte in the current block */
+    U16 radix24_prefixes[RMF_RADIX24_PREFIXES];
+    BYTE radix24_map[RADIX16_TABLE_SIZE]; /* index in radix24_prefixes, or RMF_RADIX24_NONE */
+    U32 stack[RMF_LIST_IDS];
+    RMF_tableHead list_heads[RMF_LIST_IDS];
     U32 table[1];
 };
 
+/* List id of a 3-byte prefix partitioned in init */
+#define RMF_radix24Id(index, byte_3) (RADIX16_TABLE_SIZE + ((size_t)(index) << 8) + (byte_3))
+
+/* The heads of the partitioned 2-byte prefixes only serve init, and aren't taken by a build */
+MEM_STATIC void RMF_clearRadix24Heads(struct FL2_matchTable_s* const tbl)
+{
+    for (size_t i = 0; i < tbl->radix24_count; ++i) {
+        tbl->list_heads[tbl->radix24_prefixes[i]].head = RADIX_NULL_LINK;
+        tbl->list_heads[tbl->radix24_prefixes[i]].count = 0;
+    }
+}
+
+/* Add a sample of work per position to a moving average */
+MEM_STATIC void RMF_updateCost(U32* const cost, U64 const work, U64 const positions)
+{
+    U64 const per_pos = (work << 4) / positions;
+    U32 const sample = per_pos >= (1U << 24) ? (1U << 24) : per_pos ? (U32)per_pos : 1;
+    *cost = *cost ? *cost - (*cost >> 2) + (sample >> 2) : sample;
+}
+
+void RMF_findRun(RMF_run* const run, const BYTE* const data, size_t const base, size_t const end);
 void RMF_bitpackInit(struct FL2_matchTable_s* const tbl, const void* data, size_t const end);
 void RMF_structuredInit(struct FL2_matchTable_s* const tbl, const void* data, size_t const end);
+void RMF_packedInit(struct FL2_matchTable_s* const tbl, const void* data, size_t const end);
+void RMF_bitpackInitSegment(struct FL2_matchTable_s* const tbl, const void* const data, size_t const start, size_t const end, size_t const block_end, size_t const job);
+void RMF_structuredInitSegment(struct FL2_matchTable_s* const tbl, const void* const data, size_t const start, size_t const end, size_t const block_end, size_t const job);
+void RMF_packedInitSegment(struct FL2_matchTable_s* const tbl, const void* const data, size_t const start, size_t const end, size_t const block_end, size_t const job);
+void RMF_bitpackMergeSegments(struct FL2_matchTable_s* const tbl, size_t const radix_start, size_t const radix_end);
+void RMF_structuredMergeSegments(struct FL2_matchTable_s* const tbl, size_t const radix_start, size_t const radix_end);
+void RMF_packedMergeSegments(struct FL2_matchTable_s* const tbl, size_t const radix_start, size_t const radix_end);
+void RMF_bitpackFinishSegments(struct FL2_matchTable_s* const tbl, const void* const data, size_t const end);
+void RMF_structuredFinishSegments(struct FL2_matchTable_s* const tbl, const void* const data, size_t const end);
+void RMF_packedFinishSegments(struct FL2_matchTable_s* const tbl, const void* const data, size_t const end);
+void RMF_bitpackMarkOverlap(struct FL2_matchTable_s* const tbl, const BYTE* const data_block, size_t const start, size_t const end);
+void RMF_structuredMarkOverlap(struct FL2_matchTable_s* const tbl, const BYTE* const data_block, size_t const start, size_t const end);
+void RMF_packedMarkOverlap(struct FL2_matchTable_s* const tbl, const BYTE* const data_block, size_t const start, size_t const end);
 void RMF_bitpackBuildTable(struct FL2_matchTable_s* const tbl,
     size_t const job,
     unsigned const multi_thread,
@@ -115,6 +372,10 @@ void RMF_structuredBuildTable(struct FL2_matchTable_s* const tbl,
     size_t const job,
     unsigned const multi_thread,
     FL2_dataBlock const block);
+void RMF_packedBuildTable(struct FL2_matchTable_s* const tbl,
+    size_t const job,
+    unsigned const multi_thread,
+    FL2_dataBlock const block);
 void RMF_recurseListChunk(RMF_builder* const tbl,
     const BYTE* const data_block,
     size_t const block_start,
@@ -122,12 +383,24 @@ void RMF_recurseListChunk(RMF_builder* const tbl,
     U32 const max_depth,
     U32 const list_count,
     size_t const stack_base);
+void RMF_structuredBuildReference(struct FL2_matchTable_s* const tbl, FL2_dataBlock const block);
+int RMF_suffixSort(const BYTE* const data, S32* const sa, size_t const end);
+void RMF_suffixLcp(const BYTE* const data, const S32* const sa, S32* const plcp, size_t const end);
+int RMF_bitpackSuffixLinks(struct FL2_matchTable_s* const tbl, FL2_dataBlock const block, S32* const sa, const S32* const lcp, S32* const runs);
+int RMF_structuredSuffixLinks(struct FL2_matchTable_s* const tbl, FL2_dataBlock const block, S32* const sa, const S32* const lcp, S32* const runs);
+int RMF_packedSuffixLinks(struct FL2_matchTable_s* const tbl, FL2_dataBlock const block, S32* const sa, const S32* const lcp, S32* const runs);
+void RMF_bitpackChainLinks(struct FL2_matchTable_s* const tbl, FL2_dataBlock const block, U32* const heads_3, U32* const heads_2, U32* const chain, unsigned const hash_log, unsigned const cycles);
+void RMF_structuredChainLinks(struct FL2_matchTable_s* const tbl, FL2_dataBlock const block, U32* const heads_3, U32* const heads_2, U32* const chain, unsigned const hash_log, unsigned const cycles);
+void RMF_packedChainLinks(struct FL2_matchTable_s* const tbl, FL2_dataBlock const block, U32* const heads_3, U32* const heads_2, U32* const chain, unsigned const hash_log, unsigned const cycles);
 int RMF_bitpackIntegrityCheck(const struct FL2_matchTable_s* const tbl, const BYTE* const data, size_t pos, size_t const end, unsigned max_depth);
 int RMF_structuredIntegrityCheck(const struct FL2_matchTable_s* const tbl, const BYTE* const data, size_t pos, size_t const end, unsigned max_depth);
+int RMF_packedIntegrityCheck(const struct FL2_matchTable_s* const tbl, const BYTE* const data, size_t pos, size_t const end, unsigned max_depth);
 void RMF_bitpackLimitLengths(struct FL2_matchTable_s* const tbl, size_t const pos);
 void RMF_structuredLimitLengths(struct FL2_matchTable_s* const tbl, size_t const pos);
+void RMF_packedLimitLengths(struct FL2_matchTable_s* const tbl, size_t const pos);
 BYTE* RMF_bitpackAsOutputBuffer(struct FL2_matchTable_s* const tbl, size_t const pos);
 BYTE* RMF_structuredAsOutputBuffer(struct FL2_matchTable_s* const tbl, size_t const pos);
+BYTE* RMF_packedAsOutputBuffer(struct FL2_matchTable_s* const tbl, size_t const pos);
 size_t RMF_bitpackGetMatch(const struct FL2_matchTable_s* const tbl,
     const BYTE* const data,
     size_t const pos,
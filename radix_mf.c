@@ -10,9 +10,13 @@
 
 #include <stddef.h>     /* size_t, ptrdiff_t */
 #include <stdlib.h>     /* malloc, free */
+#include <string.h>     /* memset */
 #include "fast-lzma2.h"
 #include "fl2_errors.h"
+#include "fl2_alloc.h"
+#include "fl2_numa.h"
 #include "mem.h"          /* U32, U64, MEM_64bits */
+#include "count.h"
 #include "fl2_internal.h"
 #include "radix_internal.h"
 
@@ -27,6 +31,14 @@
 #define MATCH_BUFFER_ELBOW (1UL << MATCH_BUFFER_ELBOW_BITS)
 #define MIN_MATCH_BUFFER_SIZE 256U /* min buffer size at least FL2_SEARCH_DEPTH_MAX + 2 for bounded build */
 #define MAX_MATCH_BUFFER_SIZE (1UL << 24) /* max buffer size constrained by 24-bit link values */
+#define MIN_BYTES_PER_INIT_SEGMENT (1UL << 20) /* merging costs 2 passes over a 64K head table per segment */
+#define INIT_SEGMENT_ALIGN 256U /* keep threads off each other's cache lines at segment boundaries */
+#define OVERLAP_REUSE_SLACK 16U /* DICT_shift() moves the start of the overlap down to a 16-byte boundary */
+#define ANALYSIS_MATCH_LEN_MAX 273U /* LZMA maximum match length */
+#define ANALYSIS_LITERAL_BITS 9U
+#define ADAPT_DEPTH_SAMPLE 251U /* interval of the positions sampled to adapt the depth */
+#define BUFFER_TUNE_OVERFLOW 16U /* grow the match buffers if over 1/16 of the positions are in lists too long for them */
+#define BUFFER_TUNE_SLACK 4U /* shrink them if no list overflowed and the longest was under 1/4 of their size */
 
 static void RMF_initTailTable(RMF_builder* const tbl)
 {
@@ -34,25 +46,44 @@ static void RMF_initTailTable(RMF_builder* const tbl)
         tbl->tails_8[i].prev_index = RADIX_NULL_LINK;
         tbl->tails_8[i + 1].prev_index = RADIX_NULL_LINK;
     }
-    for (size_t i = 0; i < RADIX16_TABLE_SIZE; i += 2) {
-        tbl->tails_16[i].prev_index = RADIX_NULL_LINK;
-        tbl->tails_16[i + 1].prev_index = RADIX_NULL_LINK;
-    }
+    /* Any value is valid, but the table is read before it's written */
+    memset(tbl->tails_16, 0, sizeof(tbl->tails_16));
+}
+
+/* RMF_stackSize() :
+ * A segmented init keeps the heads and firsts of every list id on each builder's stack, and the
+ * ids of partitioned 3-byte prefixes are only used in blocks of RMF_RADIX24_MIN_BLOCK or more.
+ */
+static size_t RMF_stackSize(size_t const dictionary_size, unsigned const thread_count)
+{
+    if (thread_count > 1 && dictionary_size >= RMF_RADIX24_MIN_BLOCK)
+        return RMF_LIST_IDS * 2;
+    return STACK_SIZE;
+}
+
+static size_t RMF_builderBytes(size_t const match_buffer_size, size_t const stack_size)
+{
+    return sizeof(RMF_builder) + (match_buffer_size - 1) * sizeof(RMF_buildMatch) + stack_size * sizeof(RMF_tableHead);
 }
 
-static RMF_builder* RMF_createBuilder(size_t match_buffer_size)
+static RMF_builder* RMF_createBuilder(size_t match_buffer_size, size_t const stack_size)
 {
     match_buffer_size = MIN(match_buffer_size, MAX_MATCH_BUFFER_SIZE);
     match_buffer_size = MAX(match_buffer_size, MIN_MATCH_BUFFER_SIZE);
 
-    RMF_builder* const builder = malloc(
-        sizeof(RMF_builder) + (match_buffer_size - 1) * sizeof(RMF_buildMatch));
+    RMF_builder* const builder = malloc(RMF_builderBytes(match_buffer_size, stack_size));
 
     if (builder == NULL)
         return NULL;
 
     builder->match_buffer_size = match_buffer_size;
     builder->match_buffer_limit = match_buffer_size;
+    builder->brute_limit = MAX_BRUTE_FORCE_LIST_SIZE;
+    builder->work = 0;
+    builder->work_limit = (U64)-1;
+    memset(&builder->buffer_sums, 0, sizeof(builder->buffer_sums));
+    builder->stack = (RMF_tableHead*)(builder->match_buffer + match_buffer_size);
+    builder->stack_size = stack_size;
 
     RMF_initTailTable(builder);
 
@@ -75,9 +106,9 @@ static void RMF_freeBuilderTable(RMF_builder** const builders, unsigned const si
  * max_len : maximum match length supported by the table structure 
  * size : number of threads 
  */
-static RMF_builder** RMF_createBuilderTable(U32* const match_table, size_t const match_buffer_size, unsigned const max_len, unsigned const size)
+static RMF_builder** RMF_createBuilderTable(U32* const match_table, size_t const match_buffer_size, size_t const stack_size, unsigned const max_len, unsigned const size)
 {
-    DEBUGLOG(3, "RMF_createBuilderTable : match_buffer_size %u, builders %u", (U32)match_buffer_size, size);
+    DEBUGLOG(3, "RMF_createBuilderTable : match_buffer_size %u, stack_size %u, builders %u", (U32)match_buffer_size, (U32)stack_size, size);
 
     RMF_builder** const builders = malloc(size * sizeof(RMF_builder*));
 
@@ -88,7 +119,7 @@ static RMF_builder** RMF_createBuilderTable(U32* const match_table, size_t const
         builders[i] = NULL;
 
     for (unsigned i = 0; i < size; ++i) {
-        builders[i] = RMF_createBuilder(match_buffer_size);
+        builders[i] = RMF_createBuilder(match_buffer_size, stack_size);
         if (builders[i] == NULL) {
             RMF_freeBuilderTable(builders, i);
             return NULL;
@@ -99,9 +130,37 @@ static RMF_builder** RMF_createBuilderTable(U32* const match_table, size_t const
     return builders;
 }
 
-static int RMF_isStruct(size_t const dictionary_size)
+/* RMF_tableFormat() :
+ * The packed format holds only lengths up to PACKED_MAX_LENGTH, so it is used only if the
+ * search depth doesn't exceed that. Its lengths share bytes, which allows only one builder.
+ */
+static int RMF_tableFormat(size_t const dictionary_size, unsigned const depth, unsigned const thread_count)
+{
+    if (dictionary_size > ((size_t)1 << RADIX_LINK_BITS))
+        return RMF_TABLE_STRUCTURED;
+    if (dictionary_size <= ((size_t)1 << PACKED_LINK_BITS)
+        && (MIN(depth, STRUCTURED_MAX_LENGTH) & ~1U) <= PACKED_MAX_LENGTH
+        && thread_count <= 1)
+        return RMF_TABLE_PACKED;
+    return RMF_TABLE_BITPACK;
+}
+
+static size_t RMF_tableBytes(size_t const dictionary_size, int const format)
+{
+    if (format == RMF_TABLE_STRUCTURED)
+        return UNIT_INDEX(dictionary_size + UNIT_POSITIONS - 1) * sizeof(RMF_unit) + UNIT_ALIGN - 4;
+    if (format == RMF_TABLE_PACKED)
+        return ((dictionary_size + 1) >> 1) * sizeof(RMF_packedUnit);
+    return dictionary_size * sizeof(U32);
+}
+
+static unsigned RMF_maxLength(int const format)
 {
-    return dictionary_size > ((size_t)1 << RADIX_LINK_BITS);
+    if (format == RMF_TABLE_STRUCTURED)
+        return STRUCTURED_MAX_LENGTH;
+    if (format == RMF_TABLE_PACKED)
+        return PACKED_MAX_LENGTH;
+    return BITPACK_MAX_LENGTH;
 }
 
 /* RMF_clampParams() :
@@ -118,8 +177,14 @@ static RMF_parameters RMF_clampParams(RMF_parameters params)
     }
     CLAMP(params.dictionary_size, DICTIONARY_SIZE_MIN, MEM_64bits() ? DICTIONARY_SIZE_MAX_64 : DICTIONARY_SIZE_MAX_32);
     MAXCLAMP(params.match_buffer_resize, FL2_BUFFER_RESIZE_MAX);
+    if (params.buffer_ceiling)
+        CLAMP(params.buffer_ceiling, FL2_BUFFER_CEILING_MIN, FL2_BUFFER_CEILING_MAX);
     MAXCLAMP(params.overlap_fraction, FL2_BLOCK_OVERLAP_MAX);
+    MAXCLAMP(params.large_pages, FL2_LARGEPAGES_MAX);
+    MAXCLAMP(params.prefetch_distance, FL2_PREFETCH_DISTANCE_MAX);
     CLAMP(params.depth, FL2_SEARCH_DEPTH_MIN, FL2_SEARCH_DEPTH_MAX);
+    if (params.adaptive_depth)
+        CLAMP(params.adaptive_depth, FL2_SEARCH_DEPTH_MIN, params.depth);
     return params;
 #   undef MAXCLAMP
 #   undef CLAMP
@@ -144,6 +209,13 @@ static size_t RMF_calBufSize(size_t dictionary_size, unsigned buffer_resize)
     return buffer_size;
 }
 
+/* Entries in a match buffer of buffer_ceiling Mb */
+static size_t RMF_ceilingBufSize(unsigned const buffer_ceiling)
+{
+    size_t const entries = ((size_t)buffer_ceiling << 20) / sizeof(RMF_buildMatch);
+    return MAX(MIN(entries, MAX_MATCH_BUFFER_SIZE), MIN_MATCH_BUFFER_SIZE);
+}
+
 /* RMF_applyParameters_internal() :
  * Set parameters to those specified.
  * Create a builder table if none exists. Free an existing one if incompatible.
@@ -152,22 +224,27 @@ static size_t RMF_calBufSize(size_t dictionary_size, unsigned buffer_resize)
  */
 static size_t RMF_applyParameters_internal(FL2_matchTable* const tbl, const RMF_parameters* const params)
 {
-    int const is_struct = RMF_isStruct(params->dictionary_size);
+    int const format = RMF_tableFormat(params->dictionary_size, params->depth, tbl->thread_count);
     size_t const dictionary_size = tbl->params.dictionary_size;
     /* dictionary is allocated with the struct and is immutable */
     if (params->dictionary_size > tbl->params.dictionary_size
-        || (params->dictionary_size == tbl->params.dictionary_size && is_struct > tbl->alloc_struct))
+        || RMF_tableBytes(params->dictionary_size, format) > RMF_tableBytes(dictionary_size, tbl->alloc_format))
         return FL2_ERROR(parameter_unsupported);
 
-    size_t const match_buffer_size = RMF_calBufSize(tbl->unreduced_dict_size, params->match_buffer_resize);
+    size_t match_buffer_size = RMF_calBufSize(tbl->unreduced_dict_size, params->match_buffer_resize);
+    if (params->buffer_ceiling)
+        match_buffer_size = MIN(match_buffer_size, RMF_ceilingBufSize(params->buffer_ceiling));
     tbl->params = *params;
     tbl->params.dictionary_size = dictionary_size;
-    tbl->is_struct = is_struct;
+    tbl->format = format;
+    tbl->depth_limit = params->depth;
+    tbl->next_depth = 0;
     if (tbl->builders == NULL
         || match_buffer_size > tbl->builders[0]->match_buffer_size)
     {
         RMF_freeBuilderTable(tbl->builders, tbl->thread_count);
-        tbl->builders = RMF_createBuilderTable(tbl->table, match_buffer_size, tbl->is_struct ? STRUCTURED_MAX_LENGTH : BITPACK_MAX_LENGTH, tbl->thread_count);
+        tbl->builders = RMF_createBuilderTable(tbl->table, match_buffer_size,
+            RMF_stackSize(dictionary_size, tbl->thread_count), RMF_maxLength(format), tbl->thread_count);
         if (tbl->builders == NULL) {
             return FL2_ERROR(memory_allocation);
         }
@@ -175,9 +252,11 @@ static size_t RMF_applyParameters_internal(FL2_matchTable* const tbl, const RMF_
     else {
         for (unsigned i = 0; i < tbl->thread_count; ++i) {
             tbl->builders[i]->match_buffer_limit = match_buffer_size;
-            tbl->builders[i]->max_len = tbl->is_struct ? STRUCTURED_MAX_LENGTH : BITPACK_MAX_LENGTH;
+            tbl->builders[i]->max_len = RMF_maxLength(format);
         }
     }
+    for (unsigned i = 0; i < tbl->thread_count; ++i)
+        tbl->builders[i]->prefetch_distance = params->prefetch_distance;
     return 0;
 }
 
@@ -192,12 +271,13 @@ static void RMF_reduceDict(RMF_parameters* const params, size_t const dict_reduc
 
 static void RMF_initListHeads(FL2_matchTable* const tbl)
 {
-    for (size_t i = 0; i < RADIX16_TABLE_SIZE; i += 2) {
+    for (size_t i = 0; i < RMF_LIST_IDS; i += 2) {
         tbl->list_heads[i].head = RADIX_NULL_LINK;
         tbl->list_heads[i].count = 0;
         tbl->list_heads[i + 1].head = RADIX_NULL_LINK;
         tbl->list_heads[i + 1].count = 0;
     }
+    tbl->heads_ready = 1;
 }
 
 /* RMF_createMatchTable() :
@@ -210,27 +290,48 @@ FL2_matchTable* RMF_createMatchTable(const RMF_parameters* const p, size_t const
     size_t unreduced_dict_size = params.dictionary_size;
     RMF_reduceDict(&params, dict_reduce);
 
-    int const is_struct = RMF_isStruct(params.dictionary_size);
+    unsigned const threads = thread_count + !thread_count;
+    int const format = RMF_tableFormat(params.dictionary_size, params.depth, threads);
     size_t dictionary_size = params.dictionary_size;
 
-    DEBUGLOG(3, "RMF_createMatchTable : is_struct %d, dict %u", is_struct, (U32)dictionary_size);
+    DEBUGLOG(3, "RMF_createMatchTable : format %d, dict %u", format, (U32)dictionary_size);
 
-    size_t const table_bytes = is_struct ? ((dictionary_size + 3U) / 4U) * sizeof(RMF_unit)
-        : dictionary_size * sizeof(U32);
-    FL2_matchTable* const tbl = malloc(sizeof(FL2_matchTable) + table_bytes - sizeof(U32));
+    size_t const table_bytes = RMF_tableBytes(dictionary_size, format);
+    FL2_matchTable* const tbl = FL2_largeAlloc(sizeof(FL2_matchTable) + table_bytes - sizeof(U32), params.large_pages);
     if (tbl == NULL)
         return NULL;
 
-    tbl->is_struct = is_struct;
-    tbl->alloc_struct = is_struct;
-    tbl->thread_count = thread_count + !thread_count;
+    tbl->format = format;
+    tbl->alloc_format = format;
+    tbl->alloc_pages = params.large_pages;
+    tbl->thread_count = threads;
     tbl->params = params;
     tbl->unreduced_dict_size = unreduced_dict_size;
     tbl->builders = NULL;
+    tbl->numa = NULL;
+    tbl->segment_count = 1;
+    tbl->segment_size = 0;
+    tbl->queue_count = 1;
+    tbl->split_state = RMF_SPLIT_IDLE;
+    tbl->reuse_map = NULL;
+    tbl->reuse_map_size = 0;
+    tbl->reuse_end = 0;
+    tbl->reuse_limit = 0;
+    tbl->reuse_depth = 0;
+    tbl->radix24_count = 0;
+    tbl->alt_built = 0;
+    tbl->alt_buf = NULL;
+    tbl->alt_size = 0;
+    memset(&tbl->cost, 0, sizeof(tbl->cost));
+    tbl->cost.brute_limit = MAX_BRUTE_FORCE_LIST_SIZE;
+    (void)FL2_pthread_mutex_init(&tbl->split_mutex, NULL);
+    (void)FL2_pthread_cond_init(&tbl->split_cond, NULL);
 
     RMF_applyParameters_internal(tbl, &params);
 
-    RMF_initListHeads(tbl);
+    /* The list heads are initialized by the first radix build, and a context used only for
+     * small inputs never writes their pages */
+    tbl->heads_ready = 0;
 
     RMF_initProgress(tbl);
     
@@ -245,15 +346,22 @@ void RMF_freeMatchTable(FL2_matchTable* const tbl)
     DEBUGLOG(3, "RMF_freeMatchTable");
 
     RMF_freeBuilderTable(tbl->builders, tbl->thread_count);
-    free(tbl);
+    FL2_pthread_mutex_destroy(&tbl->split_mutex);
+    FL2_pthread_cond_destroy(&tbl->split_cond);
+    free(tbl->reuse_map);
+    free(tbl->alt_buf);
+    FL2_largeFree(tbl);
 }
 
 BYTE RMF_compatibleParameters(const FL2_matchTable* const tbl, const RMF_parameters * const p, size_t const dict_reduce)
 {
     RMF_parameters params = RMF_clampParams(*p);
     RMF_reduceDict(&params, dict_reduce);
-    return tbl->params.dictionary_size > params.dictionary_size
-        || (tbl->params.dictionary_size == params.dictionary_size && tbl->alloc_struct >= RMF_isStruct(params.dictionary_size));
+    if (tbl->alloc_pages != params.large_pages)
+        return 0;
+    return tbl->params.dictionary_size >= params.dictionary_size
+        && RMF_tableBytes(tbl->params.dictionary_size, tbl->alloc_format)
+            >= RMF_tableBytes(params.dictionary_size, RMF_tableFormat(params.dictionary_size, params.depth, tbl->thread_count));
 }
 
 size_t RMF_applyParameters(FL2_matchTable* const tbl, const RMF_parameters* const p, size_t const dict_reduce)
@@ -268,22 +376,646 @@ size_t RMF_threadCount(const FL2_matchTable* const tbl)
     return tbl->thread_count;
 }
 
+/* RMF_prefaultTable() :
+ * Touch the pages of one of job_count slices of the table.
+ */
+void RMF_prefaultTable(FL2_matchTable* const tbl, size_t const job, size_t const job_count)
+{
+    size_t const table_bytes = RMF_tableBytes(tbl->params.dictionary_size, tbl->alloc_format);
+    FL2_prefault(tbl->table, table_bytes, job, job_count);
+}
+
+/* RMF_numaPlace() :
+ * Interleave the table over all nodes, because every builder and encoder reads from all of it,
+ * and place each builder on the node of the job that uses it.
+ */
+void RMF_numaPlace(FL2_matchTable* const tbl, const FL2_numa* const numa)
+{
+    size_t const table_bytes = RMF_tableBytes(tbl->params.dictionary_size, tbl->alloc_format);
+    tbl->numa = numa;
+    FL2_numaInterleave(numa, tbl->table, table_bytes);
+    for (unsigned i = 0; i < tbl->thread_count; ++i) {
+        RMF_builder* const builder = tbl->builders[i];
+        size_t const builder_bytes = RMF_builderBytes(builder->match_buffer_size, builder->stack_size);
+        FL2_numaPlace(numa, builder, builder_bytes, FL2_numaJobNode(numa, i, tbl->thread_count));
+    }
+}
+
+size_t RMF_largePageSize(const FL2_matchTable* const tbl)
+{
+    return FL2_largePageSize(tbl);
+}
+
 void RMF_initProgress(FL2_matchTable * const tbl)
 {
-    if (tbl != NULL)
-        tbl->progress = 0;
+    if (tbl == NULL)
+        return;
+    tbl->progress = 0;
+    if (tbl->builders != NULL)
+        for (unsigned i = 0; i < tbl->thread_count; ++i)
+            tbl->builders[i]->progress = 0;
+}
+
+/* Return the smallest period for which the window at data matches the bytes one period earlier, or 0 */
+static size_t RMF_runPeriod(const BYTE* const data)
+{
+#if defined(ZSTD_COUNT_VECTOR)
+    __m128i const window = _mm_loadu_si128((const __m128i*)data);
+    for (size_t period = 1; period <= RMF_RUN_PERIOD_MAX; ++period) {
+        __m128i const prev = _mm_loadu_si128((const __m128i*)(data - period));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(window, prev)) == 0xFFFF)
+            return period;
+    }
+#else
+    U64 const window_0 = MEM_read64(data);
+    U64 const window_1 = MEM_read64(data + 8);
+    for (size_t period = 1; period <= RMF_RUN_PERIOD_MAX; ++period)
+        if (MEM_read64(data - period) == window_0 && MEM_read64(data + 8 - period) == window_1)
+            return period;
+#endif
+    return 0;
+}
+
+/* RMF_findRun() :
+ * Find the next repeat of period up to RMF_RUN_PERIOD_MAX and at least RMF_RUN_MIN bytes long,
+ * testing windows from run->next onward. No repeat is extended back below base. The linked
+ * positions begin no lower than the end of the previous run, and end RMF_RUN_TAIL before the end
+ * of the repeat. The window positions are fixed, and the smallest period of a window is the
+ * smallest period of the whole repeat, so the result depends only on the data. This allows a
+ * segment to begin its search a little before its start and link exactly the same positions.
+ * If none is found, run->start and run->end are set to end.
+ */
+void RMF_findRun(RMF_run* const run, const BYTE* const data, size_t const base, size_t const end)
+{
+    size_t const prev_end = run->end;
+    size_t pos = run->next;
+    for (; pos + RMF_RUN_WINDOW <= end; pos += RMF_RUN_STRIDE) {
+        size_t const period = RMF_runPeriod(data + pos);
+        if (period == 0)
+            continue;
+        /* Back to the first position which matches the previous period */
+        size_t start = pos;
+        while (start >= base + period + sizeof(size_t)
+            && MEM_readST(data + start - sizeof(size_t)) == MEM_readST(data + start - sizeof(size_t) - period))
+            start -= sizeof(size_t);
+        while (start > base + period && data[start - 1] == data[start - 1 - period])
+            --start;
+        size_t const run_end = pos + RMF_RUN_WINDOW
+            + ZSTD_count(data + pos + RMF_RUN_WINDOW, data + pos + RMF_RUN_WINDOW - period, data + end);
+        /* Windows beginning earlier than this lie within the repeat */
+        size_t const next = (run_end - (RMF_RUN_WINDOW - 1) + RMF_RUN_STRIDE - 1) & ~(size_t)(RMF_RUN_STRIDE - 1);
+        size_t const length = run_end - (start - period);
+        start = MAX(start, prev_end);
+        if (length >= RMF_RUN_MIN && start < run_end - RMF_RUN_TAIL) {
+            DEBUGLOG(6, "RMF_findRun : %u bytes of period %u at %u", (U32)(run_end - start), (U32)period, (U32)start);
+            run->start = start;
+            run->end = run_end - RMF_RUN_TAIL;
+            run->period = period;
+            run->next = next;
+            return;
+        }
+        pos = next - RMF_RUN_STRIDE;
+    }
+    run->start = end;
+    run->end = end;
+    run->next = pos;
+}
+
+/* Choose the 2-byte prefixes to partition by the third byte in init. The counts in the head
+ * table are free until init, so they hold the sampled counts, and are cleared again after.
+ */
+static void RMF_initRadix24(FL2_matchTable* const tbl, const BYTE* const data, size_t const end)
+{
+    tbl->radix24_count = 0;
+    if (!tbl->params.radix24 || end < RMF_RADIX24_MIN_BLOCK || tbl->format == RMF_TABLE_PACKED)
+        return;
+#ifdef RMF_REFERENCE
+    if (tbl->params.use_ref_mf)
+        return;
+#endif
+    RMF_tableHead* const heads = tbl->list_heads;
+    for (size_t i = 0; i < RADIX16_TABLE_SIZE; ++i)
+        heads[i].count = 0;
+    for (size_t i = 0; i < end - 2; i += RMF_RADIX24_SAMPLE)
+        ++heads[((size_t)data[i] << 8) | data[i + 1]].count;
+
+    /* Take the prefixes in the highest classes by power of 2 which fit, then fill from the next */
+    U32 const min_count = RMF_RADIX24_MIN_COUNT / RMF_RADIX24_SAMPLE;
+    size_t classes[32];
+    memset(classes, 0, sizeof(classes));
+    for (size_t i = 0; i < RADIX16_TABLE_SIZE; ++i)
+        if (heads[i].count >= min_count)
+            ++classes[ZSTD_highbit32(heads[i].count)];
+    U32 fill_class = 32;
+    size_t total = 0;
+    while (fill_class > 0 && total + classes[fill_class - 1] <= RMF_RADIX24_PREFIXES)
+        total += classes[--fill_class];
+
+    memset(tbl->radix24_map, RMF_RADIX24_NONE, sizeof(tbl->radix24_map));
+    size_t count = 0;
+    for (size_t i = 0; i < RADIX16_TABLE_SIZE; ++i) {
+        if (heads[i].count >= min_count) {
+            U32 const c = ZSTD_highbit32(heads[i].count);
+            if (c >= fill_class || (c == fill_class - 1 && total < RMF_RADIX24_PREFIXES)) {
+                total += c < fill_class;
+                tbl->radix24_map[i] = (BYTE)count;
+                tbl->radix24_prefixes[count++] = (U16)i;
+            }
+        }
+        heads[i].count = 0;
+    }
+    tbl->radix24_count = count;
+
+    DEBUGLOG(5, "RMF_initRadix24 : %u prefixes", (U32)count);
 }
 
 void RMF_initTable(FL2_matchTable* const tbl, const void* const data, size_t const end)
 {
     DEBUGLOG(5, "RMF_initTable : size %u", (U32)end);
 
+    if (!tbl->heads_ready)
+        RMF_initListHeads(tbl);
     tbl->st_index = ATOMIC_INITIAL_VALUE;
+    RMF_initRadix24(tbl, (const BYTE*)data, end);
 
-    if (tbl->is_struct)
+    if (tbl->format == RMF_TABLE_STRUCTURED)
         RMF_structuredInit(tbl, data, end);
+    else if (tbl->format == RMF_TABLE_PACKED)
+        RMF_packedInit(tbl, data, end);
     else
         RMF_bitpackInit(tbl, data, end);
+    tbl->reuse_limit = 0;
+}
+
+/* RMF_prepareOverlapReuse() :
+ * Enable the use of positions marked by RMF_markOverlapReuse() in the next init if the
+ * block begins with an overlap of start bytes taken from the end of the marked block.
+ */
+void RMF_prepareOverlapReuse(FL2_matchTable* const tbl, size_t const start)
+{
+    tbl->reuse_limit = 0;
+    /* Marks made at a lower depth don't hold at this one */
+    if (start != 0 && tbl->reuse_end != 0 && start <= tbl->reuse_end - tbl->reuse_start
+        && tbl->params.depth <= tbl->reuse_depth)
+    {
+        DEBUGLOG(5, "RMF_prepareOverlapReuse : %u bytes", (U32)start);
+        tbl->reuse_offset = tbl->reuse_end - start - tbl->reuse_start;
+        tbl->reuse_limit = start;
+        /* Position 0 always begins a list */
+        tbl->reuse_map[tbl->reuse_offset >> 3] &= (BYTE)~(1U << (tbl->reuse_offset & 7));
+    }
+    /* Marks apply only to the block which follows */
+    tbl->reuse_end = 0;
+}
+
+/* RMF_initSegmentCount() :
+ * Prepare for a multi-threaded init and return the number of segments to initialize.
+ * If the return value is 1, RMF_initTable() must be used instead.
+ * Otherwise call RMF_initTableSegment() for each segment, then RMF_mergeTableSegments() for
+ * each segment after all are initialized, then RMF_finishTableSegments().
+ * The result is identical to RMF_initTable().
+ */
+size_t RMF_initSegmentCount(FL2_matchTable* const tbl, const void* const data, size_t const end, size_t const thread_count)
+{
+    if (!tbl->heads_ready)
+        RMF_initListHeads(tbl);
+    size_t segment_count = MIN(thread_count, tbl->thread_count);
+    segment_count = MIN(segment_count, end / MIN_BYTES_PER_INIT_SEGMENT);
+#ifdef RMF_REFERENCE
+    if (tbl->params.use_ref_mf)
+        segment_count = 1;
+#endif
+    if (segment_count < 2) {
+        tbl->segment_count = 1;
+        return 1;
+    }
+    /* The last position is linked in the finishing stage */
+    size_t const block_size = end - 2;
+    size_t segment_size = block_size / segment_count;
+    segment_size -= segment_size % INIT_SEGMENT_ALIGN;
+
+    DEBUGLOG(5, "RMF_initSegmentCount : %u segments of %u bytes", (U32)segment_count, (U32)segment_size);
+
+    tbl->segment_count = segment_count;
+    tbl->segment_size = segment_size;
+    tbl->st_index = ATOMIC_INITIAL_VALUE;
+    RMF_initRadix24(tbl, (const BYTE*)data, end);
+    return segment_count;
+}
+
+void RMF_initTableSegment(FL2_matchTable* const tbl, const void* const data, size_t const end, size_t const job)
+{
+    size_t const start = job * tbl->segment_size;
+    size_t const seg_end = (job + 1 < tbl->segment_count) ? start + tbl->segment_size : end - 2;
+
+    if (tbl->format == RMF_TABLE_STRUCTURED)
+        RMF_structuredInitSegment(tbl, data, start, seg_end, end, job);
+    else if (tbl->format == RMF_TABLE_PACKED)
+        RMF_packedInitSegment(tbl, data, start, seg_end, end, job);
+    else
+        RMF_bitpackInitSegment(tbl, data, start, seg_end, end, job);
+}
+
+void RMF_mergeTableSegments(FL2_matchTable* const tbl, size_t const job)
+{
+    size_t const list_ids = RADIX16_TABLE_SIZE + (tbl->radix24_count << 8);
+    size_t const radix_start = (list_ids * job) / tbl->segment_count;
+    size_t const radix_end = (list_ids * (job + 1)) / tbl->segment_count;
+
+    if (tbl->format == RMF_TABLE_STRUCTURED)
+        RMF_structuredMergeSegments(tbl, radix_start, radix_end);
+    else if (tbl->format == RMF_TABLE_PACKED)
+        RMF_packedMergeSegments(tbl, radix_start, radix_end);
+    else
+        RMF_bitpackMergeSegments(tbl, radix_start, radix_end);
+}
+
+void RMF_finishTableSegments(FL2_matchTable* const tbl, const void* const data, size_t const end)
+{
+    if (tbl->format == RMF_TABLE_STRUCTURED)
+        RMF_structuredFinishSegments(tbl, data, end);
+    else if (tbl->format == RMF_TABLE_PACKED)
+        RMF_packedFinishSegments(tbl, data, end);
+    else
+        RMF_bitpackFinishSegments(tbl, data, end);
+    tbl->reuse_limit = 0;
+}
+
+/* RMF_initSchedule() :
+ * Distribute the lists over thread_count builder queues for a multi-threaded build.
+ * Lists are ordered by descending size class (power of 2), preserving the order of first
+ * occurrence within each class, and dealt round-robin so each queue gets a similar share
+ * of the largest lists. Lists too short to match are dropped here.
+ */
+void RMF_initSchedule(FL2_matchTable* const tbl, size_t const thread_count)
+{
+    /* Builder 0's stack is unused until the build begins */
+    RMF_tableHead* const sorted = tbl->builders[0]->stack;
+    size_t class_start[32];
+    size_t list_count = 0;
+
+    memset(class_start, 0, sizeof(class_start));
+    for (long i = 0; i < tbl->end_index; ++i) {
+        U32 const radix_16 = tbl->stack[i];
+        U32 const count = tbl->list_heads[radix_16].count;
+        if (count < 2) {
+            /* The build would take it and do nothing else */
+            tbl->list_heads[radix_16].head = RADIX_NULL_LINK;
+            continue;
+        }
+        sorted[list_count].head = radix_16;
+        sorted[list_count].count = 31 - ZSTD_highbit32(count);
+        ++class_start[sorted[list_count].count];
+        ++list_count;
+    }
+    for (size_t i = 0, total = 0; i < 32; ++i) {
+        size_t const n = class_start[i];
+        class_start[i] = total;
+        total += n;
+    }
+
+    size_t const queue_count = MIN(thread_count, tbl->thread_count);
+    size_t const queue_size = list_count / queue_count;
+    size_t const remainder = list_count % queue_count;
+    for (size_t i = 0; i < queue_count; ++i) {
+        RMF_builder* const builder = tbl->builders[i];
+        builder->queue_start = i * queue_size + MIN(i, remainder);
+        builder->queue_end = (long)(queue_size + (i < remainder));
+        builder->queue_index = ATOMIC_INITIAL_VALUE;
+    }
+    for (size_t i = 0; i < list_count; ++i) {
+        size_t const rank = class_start[sorted[i].count]++;
+        tbl->stack[tbl->builders[rank % queue_count]->queue_start + rank / queue_count] = sorted[i].head;
+    }
+
+    DEBUGLOG(5, "RMF_initSchedule : %u lists in %u queues", (U32)list_count, (U32)queue_count);
+
+    tbl->queue_count = queue_count;
+    tbl->end_index = (long)list_count;
+    tbl->st_index = ATOMIC_INITIAL_VALUE;
+}
+
+void RMF_resetStats(FL2_matchTable* const tbl)
+{
+    memset(&tbl->quality, 0, sizeof(tbl->quality));
+    /* The cost model learns afresh in each frame */
+    memset(&tbl->cost, 0, sizeof(tbl->cost));
+    tbl->cost.brute_limit = MAX_BRUTE_FORCE_LIST_SIZE;
+    if (tbl->builders == NULL)
+        return;
+    for (unsigned i = 0; i < tbl->thread_count; ++i)
+        memset(&tbl->builders[i]->stats, 0, sizeof(tbl->builders[i]->stats));
+}
+
+/* Fold the work of each builder into the cost model for the next build. The sums don't depend
+ * on the order in which the lists were recursed. A single builder has updated the model already. */
+static void RMF_updateCostModel(FL2_matchTable* const tbl, size_t const thread_count)
+{
+    RMF_costModel* const model = &tbl->cost;
+    U64 class_positions = 0;
+    for (size_t c = 0; c < RMF_COST_CLASSES; ++c) {
+        for (size_t path = 0; path < RMF_COST_PATHS; ++path) {
+            U64 work = 0;
+            U64 positions = 0;
+            for (size_t i = 0; i < thread_count; ++i) {
+                work += tbl->builders[i]->cost_sums.work[c][path];
+                positions += tbl->builders[i]->cost_sums.positions[c][path];
+            }
+            if (positions != 0 && thread_count > 1)
+                RMF_updateCost(&model->cost[c][path], work, positions);
+        }
+        /* Lists too short to classify follow the cheapest path of the busiest of the smallest classes */
+        if (c < RMF_COST_DEPTH_CLASSES) {
+            U64 positions = 0;
+            for (size_t i = 0; i < thread_count; ++i)
+                for (size_t path = 0; path < RMF_COST_PATHS; ++path)
+                    positions += tbl->builders[i]->cost_sums.positions[c][path];
+            if (positions > class_positions) {
+                const U32* const cost = model->cost[c];
+                unsigned cheapest = 0;
+                for (unsigned path = 1; path < RMF_COST_PATHS; ++path)
+                    if (cost[path] != 0 && (cost[cheapest] == 0 || cost[path] < cost[cheapest]))
+                        cheapest = path;
+                model->brute_limit = (cheapest & RMF_COST_LONG_BRUTE) ? MAX_BRUTE_FORCE_LIST_SIZE_LONG : MAX_BRUTE_FORCE_LIST_SIZE;
+                class_positions = positions;
+            }
+        }
+    }
+}
+
+/* Reallocate every builder with a match buffer of match_buffer_size entries. A builder which
+ * can't be reallocated keeps its buffer, and all use the smallest buffer of any. */
+static void RMF_resizeBuilders(FL2_matchTable* const tbl, size_t const match_buffer_size)
+{
+    size_t limit = match_buffer_size;
+    for (unsigned i = 0; i < tbl->thread_count; ++i) {
+        RMF_builder* builder = tbl->builders[i];
+        RMF_builder* const resized = realloc(builder, RMF_builderBytes(match_buffer_size, builder->stack_size));
+        if (resized != NULL) {
+            builder = resized;
+            builder->match_buffer_size = match_buffer_size;
+            /* The stack holds nothing between builds */
+            builder->stack = (RMF_tableHead*)(builder->match_buffer + match_buffer_size);
+            tbl->builders[i] = builder;
+            if (tbl->numa != NULL && tbl->numa->node_count > 1)
+                FL2_numaPlace(tbl->numa, builder, RMF_builderBytes(match_buffer_size, builder->stack_size),
+                    FL2_numaJobNode(tbl->numa, i, tbl->thread_count));
+        }
+        limit = MIN(limit, builder->match_buffer_size);
+    }
+    for (unsigned i = 0; i < tbl->thread_count; ++i)
+        tbl->builders[i]->match_buffer_limit = limit;
+}
+
+/* RMF_tuneBuffers() :
+ * Resize the match buffers for the next build if buffer_ceiling is set. Lists too long for the
+ * buffer are partitioned in the table, which is slower, so the buffers grow to fit the longest
+ * of them if they hold a significant share of the positions. Buffers much larger than every
+ * list shrink, but not below the size for the smallest buffer_resize. Decisions depend only on
+ * list lengths, so the output doesn't depend on timing.
+ */
+static void RMF_tuneBuffers(FL2_matchTable* const tbl, size_t const thread_count)
+{
+    if (!tbl->params.buffer_ceiling)
+        return;
+
+    U64 positions = 0;
+    U64 overflow = 0;
+    size_t overflow_max = 0;
+    size_t largest = 0;
+    for (size_t i = 0; i < thread_count; ++i) {
+        const RMF_bufferSums* const sums = &tbl->builders[i]->buffer_sums;
+        positions += sums->positions;
+        overflow += sums->overflow;
+        overflow_max = MAX(overflow_max, sums->overflow_max);
+        largest = MAX(largest, sums->largest);
+    }
+    if (positions == 0)
+        return;
+
+    size_t const size = tbl->builders[0]->match_buffer_limit;
+    size_t new_size = size;
+    if (overflow * BUFFER_TUNE_OVERFLOW > positions)
+        new_size = MIN(overflow_max + (overflow_max >> 2), RMF_ceilingBufSize(tbl->params.buffer_ceiling));
+    else if (overflow == 0 && largest * BUFFER_TUNE_SLACK < size)
+        new_size = MAX(largest * 2, RMF_calBufSize(tbl->unreduced_dict_size, 0));
+    new_size = MAX(new_size, MIN_MATCH_BUFFER_SIZE);
+    if (new_size == size)
+        return;
+
+    DEBUGLOG(5, "RMF_tuneBuffers : %u of %u positions overflowed, largest %u, size %u -> %u",
+        (U32)overflow, (U32)positions, (U32)MAX(overflow_max, largest), (U32)size, (U32)new_size);
+
+    RMF_resizeBuilders(tbl, new_size);
+}
+
+/* RMF_accumulateStats() :
+ * Add the time of the build just completed to the builder stats, and update the cost model.
+ * Call after all thread_count builders have returned from RMF_buildTable().
+ */
+void RMF_accumulateStats(FL2_matchTable* const tbl, size_t const thread_count)
+{
+    /* Measure back from now so no span is negative */
+    UTIL_time_t const now = UTIL_getTime();
+    U64 last_finish = (U64)-1;
+    for (size_t i = 0; i < thread_count; ++i)
+        last_finish = MIN(last_finish, UTIL_getSpanTimeMicro(tbl->builders[i]->end_time, now));
+    for (size_t i = 0; i < thread_count; ++i) {
+        RMF_builder* const builder = tbl->builders[i];
+        builder->stats.busyMicro += UTIL_getSpanTimeMicro(builder->start_time, builder->end_time);
+        builder->stats.idleMicro += UTIL_getSpanTimeMicro(builder->end_time, now) - last_finish;
+    }
+    RMF_updateCostModel(tbl, thread_count);
+    RMF_tuneBuffers(tbl, thread_count);
+}
+
+size_t RMF_getBuilderStats(const FL2_matchTable* const tbl, size_t const job, FL2_builderStats* const stats)
+{
+    if (job >= tbl->thread_count)
+        return FL2_ERROR(parameter_outOfBound);
+    *stats = tbl->builders[job]->stats;
+    stats->bufferSize = tbl->builders[job]->match_buffer_limit;
+    return 0;
+}
+
+/* Read the link and length at pos in any table format. Returns RADIX_NULL_LINK if there is no match. */
+static U32 RMF_readLink(const FL2_matchTable* const tbl, size_t const pos, U32* const length)
+{
+    if (tbl->format == RMF_TABLE_STRUCTURED) {
+        const RMF_unit* const unit = RMF_unitTable(tbl->table) + UNIT_INDEX(pos);
+        *length = unit->lengths[UNIT_SLOT(pos)];
+        return unit->links[UNIT_SLOT(pos)];
+    }
+    if (tbl->format == RMF_TABLE_PACKED) {
+        U32 const link = RMF_packedGetLink(tbl->table, pos);
+        *length = RMF_packedGetLength(tbl->table, pos);
+        return (link == PACKED_NULL_LINK) ? RADIX_NULL_LINK : link;
+    }
+    *length = tbl->table[pos] >> RADIX_LINK_BITS;
+    return (tbl->table[pos] == RADIX_NULL_LINK) ? RADIX_NULL_LINK : (tbl->table[pos] & RADIX_LINK_MASK);
+}
+
+/* Get the match length the encoder takes from the table at pos. As in radix_get.h, a length
+ * which reaches the search depth or the format's maximum is extended. */
+static size_t RMF_analysisMatch(const FL2_matchTable* const tbl, const BYTE* const data, size_t const pos, size_t const end, size_t* const dist)
+{
+    U32 length;
+    U32 const link = RMF_readLink(tbl, pos, &length);
+    if (link == RADIX_NULL_LINK)
+        return 0;
+    *dist = pos - link;
+    size_t const limit = MIN(end, pos + ANALYSIS_MATCH_LEN_MAX);
+    if (length == tbl->params.depth || length == RMF_maxLength(tbl->format))
+        return ZSTD_count(data + pos, data + link, data + limit);
+    return MIN(length, limit - pos);
+}
+
+/* One step of a greedy parse, priced in bits with a rough LZMA model */
+static size_t RMF_analysisParse(size_t const length, size_t const dist, U64* const bits)
+{
+    if (length >= 2) {
+        size_t const match_bits = 10U + ZSTD_highbit32((U32)dist) + ((length >= 10) ? 8U : 3U);
+        if (match_bits < length * ANALYSIS_LITERAL_BITS) {
+            *bits += match_bits;
+            return length;
+        }
+    }
+    *bits += ANALYSIS_LITERAL_BITS;
+    return 1;
+}
+
+/* RMF_analyzeMatches() :
+ * Build a reference table for the block and compare its matches with those in the table just built.
+ * Call after a successful build and before encoding. Does nothing unless match_analysis is set.
+ * Returns an error if the reference table can't be allocated.
+ */
+size_t RMF_analyzeMatches(FL2_matchTable* const tbl, FL2_dataBlock const block)
+{
+    if (!tbl->params.match_analysis || block.end <= block.start)
+        return FL2_error_no_error;
+
+    size_t const table_bytes = RMF_tableBytes(block.end, RMF_TABLE_STRUCTURED);
+    FL2_matchTable* const ref = malloc(sizeof(FL2_matchTable) + table_bytes - sizeof(U32));
+    if (ref == NULL)
+        return FL2_ERROR(memory_allocation);
+    /* The reference build reads fields not set below */
+    memset(ref, 0, sizeof(FL2_matchTable));
+    ref->params = tbl->params;
+    ref->params.depth = STRUCTURED_MAX_LENGTH & ~1U;
+    ref->format = RMF_TABLE_STRUCTURED;
+    ref->alloc_format = RMF_TABLE_STRUCTURED;
+    ref->thread_count = 1;
+    ref->builders = RMF_createBuilderTable(ref->table, MIN_MATCH_BUFFER_SIZE, STACK_SIZE, STRUCTURED_MAX_LENGTH, 1);
+    if (ref->builders == NULL) {
+        free(ref);
+        return FL2_ERROR(memory_allocation);
+    }
+    RMF_initListHeads(ref);
+    RMF_structuredBuildReference(ref, block);
+
+    DEBUGLOG(5, "RMF_analyzeMatches : from %u to %u", (U32)block.start, (U32)block.end);
+
+    FL2_matchQuality* const quality = &tbl->quality;
+    size_t radix_next = block.start;
+    size_t ref_next = block.start;
+    U64 radix_bits = 0;
+    U64 ref_bits = 0;
+    for (size_t pos = block.start; pos < block.end; ++pos) {
+        size_t radix_dist = 0;
+        size_t ref_dist = 0;
+        size_t const radix_len = RMF_analysisMatch(tbl, block.data, pos, block.end, &radix_dist);
+        size_t const ref_len = RMF_analysisMatch(ref, block.data, pos, block.end, &ref_dist);
+        if (radix_len) {
+            ++quality->radixMatches;
+            ++quality->radixDist[ZSTD_highbit32((U32)radix_dist)];
+        }
+        if (ref_len) {
+            ++quality->refMatches;
+            ++quality->refDist[ZSTD_highbit32((U32)ref_dist)];
+        }
+        if (radix_len < ref_len) {
+            ++quality->shorter;
+            quality->lengthDeficit += ref_len - radix_len;
+            quality->missedLong += (ref_len >= FL2_MATCHQ_LONG_LENGTH && radix_len < FL2_MATCHQ_LONG_LENGTH);
+        }
+        if (pos == radix_next)
+            radix_next += RMF_analysisParse(radix_len, radix_dist, &radix_bits);
+        if (pos == ref_next)
+            ref_next += RMF_analysisParse(ref_len, ref_dist, &ref_bits);
+    }
+    quality->positions += block.end - block.start;
+    quality->radixCost += (radix_bits + 7) >> 3;
+    quality->refCost += (ref_bits + 7) >> 3;
+
+    RMF_freeBuilderTable(ref->builders, 1);
+    free(ref);
+    return FL2_error_no_error;
+}
+
+void RMF_getMatchQuality(const FL2_matchTable* const tbl, FL2_matchQuality* const quality)
+{
+    *quality = tbl->quality;
+}
+
+/* RMF_adaptDepth() :
+ * Choose the search depth for the next block from a sample of the matches just built, between
+ * adaptive_depth and the depth set by the caller. A match which reaches the depth links to the
+ * nearest of the positions sharing that many bytes. If it usually ends soon after the depth, a
+ * deeper search could find a longer one further back, so the depth is raised. If matches rarely
+ * reach the depth, or usually run well past it, the deepest levels of recursion are wasted and
+ * the depth is lowered. Call after a successful build and before encoding, which overwrites the
+ * table. The new depth takes effect in RMF_setBlockDepth(). Does nothing unless adaptive_depth is set.
+ */
+void RMF_adaptDepth(FL2_matchTable* const tbl, FL2_dataBlock const block)
+{
+    /* A suffix array or hash chain build doesn't share the radix build's cost in depth */
+    if (!tbl->params.adaptive_depth || tbl->alt_built || block.end < block.start + ADAPT_DEPTH_SAMPLE)
+        return;
+
+    unsigned const max_depth = MIN(MIN(tbl->params.depth, STRUCTURED_MAX_LENGTH) & ~1U, RMF_maxLength(tbl->format));
+    size_t matched = 0;
+    size_t capped = 0;
+    size_t short_runs = 0;
+    for (size_t pos = block.start; pos < block.end - 2; pos += ADAPT_DEPTH_SAMPLE) {
+        U32 length;
+        U32 const link = RMF_readLink(tbl, pos, &length);
+        if (link == RADIX_NULL_LINK)
+            continue;
+        ++matched;
+        if (length < max_depth)
+            continue;
+        ++capped;
+        /* Compare up to half the depth again */
+        size_t const limit = MIN(block.end, pos + length + (max_depth >> 1));
+        if (pos + length >= limit
+            || pos + length + ZSTD_count(block.data + pos + length, block.data + link + length, block.data + limit) < limit)
+            ++short_runs;
+    }
+    if (matched == 0)
+        return;
+
+    unsigned depth = tbl->params.depth;
+    if (capped * 16 >= matched && short_runs * 2 >= capped)
+        depth += depth >> 1;
+    else if (capped * 64 < matched || short_runs * 3 < capped)
+        depth -= depth >> 2;
+    /* The builder only uses even depths */
+    depth = MAX(depth & ~1U, (tbl->params.adaptive_depth + 1) & ~1U);
+    depth = MIN(depth, tbl->depth_limit);
+
+    DEBUGLOG(5, "RMF_adaptDepth : %u matched, %u capped, %u short, depth %u -> %u",
+        (U32)matched, (U32)capped, (U32)short_runs, tbl->params.depth, depth);
+
+    tbl->next_depth = depth;
+}
+
+/* RMF_setBlockDepth() :
+ * Use the depth chosen by RMF_adaptDepth() for the block about to be initialized.
+ */
+void RMF_setBlockDepth(FL2_matchTable* const tbl)
+{
+    if (tbl->next_depth)
+        tbl->params.depth = tbl->next_depth;
 }
 
 static void RMF_handleRepeat(RMF_buildMatch* const match_buffer,
@@ -332,11 +1064,14 @@ static void RMF_bruteForceBuffered(RMF_builder* const tbl,
     size_t const depth,
     size_t const max_depth)
 {
-    BruteForceMatch buffer[MAX_BRUTE_FORCE_LIST_SIZE + 1];
+    BruteForceMatch buffer[MAX_BRUTE_FORCE_LIST_SIZE_LONG + 1];
     const BYTE* const data_src = data_block + depth;
     size_t const limit = max_depth - depth;
     const BYTE* const start = data_src + block_start;
     size_t i = 0;
+    size_t compared = 0;
+    ++tbl->stats.bruteLists;
+    tbl->work += (list_count * (list_count - 1) >> 1) * RMF_WORK_PAIR;
     for (;;) {
         /* Load all locations from the match buffer */
         buffer[i].pos = pos;
@@ -364,8 +1099,8 @@ static void RMF_bruteForceBuffered(RMF_builder* const tbl,
             if (len_test) {
                 /* Complete the match length count in the raw input buffer */
                 const BYTE* data_2 = buffer[j].data_src;
-                while (data[len_test] == data_2[len_test] && len_test < limit)
-                    ++len_test;
+                len_test += ZSTD_count(data + len_test, data_2 + len_test, data + limit);
+                compared += len_test;
             }
             if (len_test > longest) {
                 longest_index = j;
@@ -381,6 +1116,10 @@ static void RMF_bruteForceBuffered(RMF_builder* const tbl,
         }
         ++i;
     } while (i < list_count - 1 && buffer[i].data_src >= start);
+    /* Only counted for the budget. The cost model must not see it, so the default output
+     * doesn't depend on whether a budget could be set. */
+    if (tbl->work_limit != (U64)-1)
+        tbl->work += compared >> RMF_WORK_BYTES_SHIFT;
 }
 
 /* Lengthen and divide buffered chains into smaller chains, save them on a stack and process in turn. 
@@ -398,6 +1137,7 @@ void RMF_recurseListChunk_generic(RMF_builder* const tbl,
     U32 const base_depth = depth;
     size_t st_index = stack_base;
     size_t pos = 0;
+    tbl->work += list_count * RMF_WORK_LEVEL;
     ++depth;
     /* The last element is done separately and won't be copied back at the end */
     --list_count;
@@ -450,9 +1190,13 @@ void RMF_recurseListChunk_generic(RMF_builder* const tbl,
             /* Chain starts in the overlap region which is already encoded */
             continue;
         }
-        /* Check stack space. The first comparison is unnecessary but it's a constant so should be faster */
-        if (st_index > STACK_SIZE - RADIX8_TABLE_SIZE
-            && st_index > STACK_SIZE - list_count)
+        if (tbl->work > tbl->work_limit) {
+            /* Over budget. The list stays linked at its current length. */
+            continue;
+        }
+        /* Check stack space. The first comparison is unnecessary but it rarely passes */
+        if (st_index > tbl->stack_size - RADIX8_TABLE_SIZE
+            && st_index > tbl->stack_size - list_count)
         {
             /* Stack may not be able to fit all possible new items. This is very rare. */
             continue;
@@ -460,7 +1204,8 @@ void RMF_recurseListChunk_generic(RMF_builder* const tbl,
         depth = tbl->match_buffer[pos].next >> 24;
         /* Index into the 4-byte pre-loaded input char cache */
         size_t slot = (depth - base_depth) & 3;
-        if (list_count <= MAX_BRUTE_FORCE_LIST_SIZE) {
+        tbl->work += list_count * RMF_WORK_LEVEL;
+        if (list_count <= tbl->brute_limit) {
             /* Quicker to use brute force, each string compared with all previous strings */
             RMF_bruteForceBuffered(tbl,
                 data_block,
@@ -664,7 +1409,7 @@ void RMF_recurseListChunk(RMF_builder* const tbl,
     if (list_count < 2)
         return;
     /* Template-like inline functions */
-    if (list_count <= MAX_BRUTE_FORCE_LIST_SIZE)
+    if (list_count <= tbl->brute_limit)
         RMF_bruteForceBuffered(tbl, data_block, block_start, 0, list_count, 0, depth, max_depth);
     else if (max_depth > 6)
         RMF_recurseListChunk_generic(tbl, data_block, block_start, depth, max_depth, list_count, stack_base);
@@ -680,11 +1425,25 @@ int RMF_buildTable(FL2_matchTable* const tbl,
 {
     DEBUGLOG(5, "RMF_buildTable : thread %u", (U32)job);
 
-    if (tbl->is_struct)
+    tbl->builders[job]->start_time = UTIL_getTime();
+    tbl->builders[job]->brute_limit = tbl->cost.brute_limit;
+    tbl->builders[job]->work = 0;
+    tbl->builders[job]->work_limit = (U64)-1;
+    memset(&tbl->builders[job]->cost_sums, 0, sizeof(tbl->builders[job]->cost_sums));
+    memset(&tbl->builders[job]->buffer_sums, 0, sizeof(tbl->builders[job]->buffer_sums));
+
+    if (tbl->format == RMF_TABLE_STRUCTURED)
         RMF_structuredBuildTable(tbl, job, multi_thread, block);
+    else if (tbl->format == RMF_TABLE_PACKED)
+        RMF_packedBuildTable(tbl, job, multi_thread, block);
     else
         RMF_bitpackBuildTable(tbl, job, multi_thread, block);
 
+    tbl->builders[job]->end_time = UTIL_getTime();
+
+    if (job == 0)
+        tbl->alt_built = 0;
+
     if (job == 0 && tbl->st_index >= RADIX_CANCEL_INDEX) {
         RMF_initListHeads(tbl);
         return 1;
@@ -692,6 +1451,101 @@ int RMF_buildTable(FL2_matchTable* const tbl,
     return 0;
 }
 
+/* RMF_buildSuffixTable() :
+ * Fill the table for the block from a suffix array of all its data, in place of the init and
+ * radix build. Each position links to the nearest earlier position sharing the search depth, or
+ * else to its longest match, with none of the shortcuts a radix build takes on long lists. The sort
+ * runs in the calling thread.
+ * Returns 0, or 1 if the block is too large or memory is short, in which case the caller
+ * builds the table with the radix match finder.
+ */
+int RMF_buildSuffixTable(FL2_matchTable* const tbl, FL2_dataBlock const block)
+{
+    tbl->alt_built = 0;
+    if (block.end > RMF_SUFFIX_MAX || block.end > ((size_t)-1 >> 4))
+        return 1;
+
+    /* The sentinel and the suffix array, the LCP in suffix order, and the LCP in text order */
+    size_t const size = block.end * 3 + 1;
+    if (size > tbl->alt_size) {
+        free(tbl->alt_buf);
+        tbl->alt_buf = malloc(size * sizeof(S32));
+        tbl->alt_size = (tbl->alt_buf != NULL) ? size : 0;
+        if (tbl->alt_buf == NULL)
+            return 1;
+    }
+    S32* const sa = tbl->alt_buf;
+    S32* const lcp = sa + block.end + 1;
+    S32* const plcp = lcp + block.end;
+
+    DEBUGLOG(5, "RMF_buildSuffixTable : from %u to %u", (U32)block.start, (U32)block.end);
+
+    if (RMF_suffixSort(block.data, sa, block.end) != 0)
+        return 1;
+    RMF_suffixLcp(block.data, sa + 1, plcp, block.end);
+    for (size_t k = 0; k < block.end; ++k)
+        lcp[k] = plcp[sa[k + 1]];
+
+    int err;
+    if (tbl->format == RMF_TABLE_STRUCTURED)
+        err = RMF_structuredSuffixLinks(tbl, block, sa + 1, lcp, plcp);
+    else if (tbl->format == RMF_TABLE_PACKED)
+        err = RMF_packedSuffixLinks(tbl, block, sa + 1, lcp, plcp);
+    else
+        err = RMF_bitpackSuffixLinks(tbl, block, sa + 1, lcp, plcp);
+    if (err)
+        return 1;
+
+    tbl->progress = block.end;
+    tbl->alt_built = 1;
+    return 0;
+}
+
+/* RMF_buildChainTable() :
+ * Fill the table for a small block from hash chains sized to the block, in place of the init and
+ * radix build. Each position links to the longest match among a number of candidates which scales
+ * with the depth. Runs in the calling thread.
+ * Returns 0, or 1 if the block is too large or memory is short, in which case the caller
+ * builds the table with the radix match finder.
+ */
+int RMF_buildChainTable(FL2_matchTable* const tbl, FL2_dataBlock const block)
+{
+    tbl->alt_built = 0;
+    if (block.end >= RMF_CHAIN_MAX)
+        return 1;
+
+    unsigned hash_log = RMF_CHAIN_HASH_LOG_MIN;
+    while (hash_log < RMF_CHAIN_HASH_LOG_MAX && ((size_t)2 << hash_log) <= block.end)
+        ++hash_log;
+
+    /* Two head tables and a chain link per position */
+    size_t const size = ((size_t)2 << hash_log) + block.end;
+    if (size > tbl->alt_size) {
+        free(tbl->alt_buf);
+        tbl->alt_buf = malloc(size * sizeof(S32));
+        tbl->alt_size = (tbl->alt_buf != NULL) ? size : 0;
+        if (tbl->alt_buf == NULL)
+            return 1;
+    }
+    U32* const heads_3 = (U32*)tbl->alt_buf;
+    U32* const heads_2 = heads_3 + ((size_t)1 << hash_log);
+    U32* const chain = heads_2 + ((size_t)1 << hash_log);
+    unsigned const cycles = RMF_CHAIN_CYCLES(tbl->params.depth);
+
+    DEBUGLOG(5, "RMF_buildChainTable : from %u to %u, hash log %u", (U32)block.start, (U32)block.end, hash_log);
+
+    if (tbl->format == RMF_TABLE_STRUCTURED)
+        RMF_structuredChainLinks(tbl, block, heads_3, heads_2, chain, hash_log, cycles);
+    else if (tbl->format == RMF_TABLE_PACKED)
+        RMF_packedChainLinks(tbl, block, heads_3, heads_2, chain, hash_log, cycles);
+    else
+        RMF_bitpackChainLinks(tbl, block, heads_3, heads_2, chain, hash_log, cycles);
+
+    tbl->progress = block.end;
+    tbl->alt_built = 1;
+    return 0;
+}
+
 void RMF_cancelBuild(FL2_matchTable * const tbl)
 {
     if(tbl != NULL)
@@ -701,36 +1555,88 @@ void RMF_cancelBuild(FL2_matchTable * const tbl)
 void RMF_resetIncompleteBuild(FL2_matchTable * const tbl)
 {
     RMF_initListHeads(tbl);
+    tbl->reuse_end = 0;
+}
+
+/* RMF_markOverlapReuse() :
+ * Call after a successful build and before encoding, which overwrites the table.
+ * Positions in the last overlap bytes of the block which cannot be the best match for any
+ * later position are marked so that the init for the next block can leave them out of the lists.
+ * Does nothing unless reuse_overlap is set.
+ */
+void RMF_markOverlapReuse(FL2_matchTable* const tbl, FL2_dataBlock const block, size_t const overlap)
+{
+    tbl->reuse_end = 0;
+    /* The marks depend on the lists of a radix build */
+    if (!tbl->params.reuse_overlap || overlap == 0 || tbl->alt_built)
+        return;
+#ifdef RMF_REFERENCE
+    if (tbl->params.use_ref_mf)
+        return;
+#endif
+
+    size_t const start = block.end - MIN(block.end, overlap + OVERLAP_REUSE_SLACK);
+    size_t const map_size = ((block.end - start) >> 3) + 1;
+    if (map_size > tbl->reuse_map_size) {
+        free(tbl->reuse_map);
+        tbl->reuse_map = malloc(map_size);
+        tbl->reuse_map_size = (tbl->reuse_map != NULL) ? map_size : 0;
+        if (tbl->reuse_map == NULL)
+            return;
+    }
+
+    DEBUGLOG(5, "RMF_markOverlapReuse : from %u to %u", (U32)start, (U32)block.end);
+
+    if (tbl->format == RMF_TABLE_STRUCTURED)
+        RMF_structuredMarkOverlap(tbl, block.data, start, block.end);
+    else if (tbl->format == RMF_TABLE_PACKED)
+        RMF_packedMarkOverlap(tbl, block.data, start, block.end);
+    else
+        RMF_bitpackMarkOverlap(tbl, block.data, start, block.end);
+
+    tbl->reuse_start = start;
+    tbl->reuse_end = block.end;
+    tbl->reuse_depth = tbl->params.depth;
 }
 
 int RMF_integrityCheck(const FL2_matchTable* const tbl, const BYTE* const data, size_t const pos, size_t const end, unsigned const max_depth)
 {
-    if (tbl->is_struct)
+    if (tbl->format == RMF_TABLE_STRUCTURED)
         return RMF_structuredIntegrityCheck(tbl, data, pos, end, max_depth);
+    else if (tbl->format == RMF_TABLE_PACKED)
+        return RMF_packedIntegrityCheck(tbl, data, pos, end, max_depth);
     else
         return RMF_bitpackIntegrityCheck(tbl, data, pos, end, max_depth);
 }
 
 void RMF_limitLengths(FL2_matchTable* const tbl, size_t const pos)
 {
-    if (tbl->is_struct)
+    if (tbl->format == RMF_TABLE_STRUCTURED)
         RMF_structuredLimitLengths(tbl, pos);
+    else if (tbl->format == RMF_TABLE_PACKED)
+        RMF_packedLimitLengths(tbl, pos);
     else
         RMF_bitpackLimitLengths(tbl, pos);
 }
 
 BYTE* RMF_getTableAsOutputBuffer(FL2_matchTable* const tbl, size_t const pos)
 {
-    if (tbl->is_struct)
+    if (tbl->format == RMF_TABLE_STRUCTURED)
         return RMF_structuredAsOutputBuffer(tbl, pos);
+    else if (tbl->format == RMF_TABLE_PACKED)
+        return RMF_packedAsOutputBuffer(tbl, pos);
     else
         return RMF_bitpackAsOutputBuffer(tbl, pos);
 }
 
-size_t RMF_memoryUsage(size_t const dict_size, unsigned const buffer_resize, unsigned const thread_count)
+size_t RMF_memoryUsage(size_t const dict_size, unsigned const depth, unsigned const buffer_resize, unsigned const buffer_ceiling, unsigned const suffix_array, unsigned const thread_count)
 {
-    size_t size = (size_t)(4U + RMF_isStruct(dict_size)) * dict_size;
-    size_t const buf_size = RMF_calBufSize(dict_size, buffer_resize);
-    size += ((buf_size - 1) * sizeof(RMF_buildMatch) + sizeof(RMF_builder)) * thread_count;
+    size_t size = RMF_tableBytes(dict_size, RMF_tableFormat(dict_size, depth, thread_count));
+    /* A self-tuning buffer can grow to the ceiling */
+    size_t const buf_size = buffer_ceiling ? RMF_ceilingBufSize(buffer_ceiling) : RMF_calBufSize(dict_size, buffer_resize);
+    size += RMF_builderBytes(buf_size, RMF_stackSize(dict_size, thread_count)) * thread_count;
+    /* The suffix array and both LCP arrays, and the sort's bucket table for the names of the first recursion */
+    if (suffix_array)
+        size += (dict_size * 3 + 1) * sizeof(S32) + (dict_size >> 1) * sizeof(S32);
     return size;
 }
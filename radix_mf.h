@@ -13,6 +13,7 @@
 
 #include "fast-lzma2.h"
 #include "data_block.h"
+#include "fl2_numa.h"
 
 #if defined (__cplusplus)
 extern "C" {
@@ -31,6 +32,17 @@ typedef struct
     unsigned overlap_fraction;
     unsigned divide_and_conquer;
     unsigned depth;
+    unsigned reuse_overlap;
+    unsigned large_pages;
+    unsigned prefetch_distance;
+    unsigned match_analysis;
+    unsigned radix24;
+    unsigned adaptive_depth; /* minimum depth, or 0 for a fixed depth */
+    unsigned buffer_ceiling; /* Mb per builder for a self-tuning match buffer, or 0 for a fixed size */
+    unsigned suffix_array;   /* build the table from a suffix array instead of radix sorting */
+    unsigned link_runs;      /* link long short-period repeats directly in init */
+    unsigned work_budget;    /* degrade lists which exceed RMF_WORK_BUDGET */
+    unsigned cost_model;     /* choose the path of long lists with the cost model */
 #ifdef RMF_REFERENCE
     unsigned use_ref_mf;
 #endif
@@ -41,18 +53,37 @@ void RMF_freeMatchTable(FL2_matchTable* const tbl);
 BYTE RMF_compatibleParameters(const FL2_matchTable* const tbl, const RMF_parameters* const params, size_t const dict_reduce);
 size_t RMF_applyParameters(FL2_matchTable* const tbl, const RMF_parameters* const params, size_t const dict_reduce);
 size_t RMF_threadCount(const FL2_matchTable * const tbl);
+void RMF_prefaultTable(FL2_matchTable* const tbl, size_t const job, size_t const job_count);
+void RMF_numaPlace(FL2_matchTable* const tbl, const FL2_numa* const numa);
+size_t RMF_largePageSize(const FL2_matchTable* const tbl);
 void RMF_initProgress(FL2_matchTable * const tbl);
 void RMF_initTable(FL2_matchTable* const tbl, const void* const data, size_t const end);
+size_t RMF_initSegmentCount(FL2_matchTable* const tbl, const void* const data, size_t const end, size_t const thread_count);
+void RMF_initTableSegment(FL2_matchTable* const tbl, const void* const data, size_t const end, size_t const job);
+void RMF_mergeTableSegments(FL2_matchTable* const tbl, size_t const job);
+void RMF_finishTableSegments(FL2_matchTable* const tbl, const void* const data, size_t const end);
+void RMF_prepareOverlapReuse(FL2_matchTable* const tbl, size_t const start);
+void RMF_initSchedule(FL2_matchTable* const tbl, size_t const thread_count);
 int RMF_buildTable(FL2_matchTable* const tbl,
     size_t const job,
     unsigned const multi_thread,
     FL2_dataBlock const block);
+int RMF_buildSuffixTable(FL2_matchTable* const tbl, FL2_dataBlock const block);
+int RMF_buildChainTable(FL2_matchTable* const tbl, FL2_dataBlock const block);
 void RMF_cancelBuild(FL2_matchTable* const tbl);
+void RMF_resetStats(FL2_matchTable* const tbl);
+void RMF_accumulateStats(FL2_matchTable* const tbl, size_t const thread_count);
+size_t RMF_getBuilderStats(const FL2_matchTable* const tbl, size_t const job, FL2_builderStats* const stats);
+size_t RMF_analyzeMatches(FL2_matchTable* const tbl, FL2_dataBlock const block);
+void RMF_getMatchQuality(const FL2_matchTable* const tbl, FL2_matchQuality* const quality);
+void RMF_adaptDepth(FL2_matchTable* const tbl, FL2_dataBlock const block);
+void RMF_setBlockDepth(FL2_matchTable* const tbl);
+void RMF_markOverlapReuse(FL2_matchTable* const tbl, FL2_dataBlock const block, size_t const overlap);
 void RMF_resetIncompleteBuild(FL2_matchTable* const tbl);
 int RMF_integrityCheck(const FL2_matchTable* const tbl, const BYTE* const data, size_t const pos, size_t const end, unsigned const max_depth);
 void RMF_limitLengths(FL2_matchTable* const tbl, size_t const pos);
 BYTE* RMF_getTableAsOutputBuffer(FL2_matchTable* const tbl, size_t const pos);
-size_t RMF_memoryUsage(size_t const dict_size, unsigned const buffer_resize, unsigned const thread_count);
+size_t RMF_memoryUsage(size_t const dict_size, unsigned const depth, unsigned const buffer_resize, unsigned const buffer_ceiling, unsigned const suffix_array, unsigned const thread_count);
 
 #if defined (__cplusplus)
 }
@@ -0,0 +1,57 @@
+/*
+* Copyright (c) 2019, Conor McCarthy
+* All rights reserved.
+*
+* This source code is licensed under both the BSD-style license (found in the
+* LICENSE file in the root directory of this source tree) and the GPLv2 (found
+* in the COPYING file in the root directory of this source tree).
+* You may select, at your option, one of the above-listed licenses.
+*/
+
+#include "mem.h"          /* U32, U64 */
+#include "fl2_threading.h"
+#include "fl2_internal.h"
+#include "radix_internal.h"
+
+#undef MIN
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+
+#define RMF_PACKED
+
+#define RADIX_MAX_LENGTH PACKED_MAX_LENGTH
+
+#define InitMatchLink(pos, link) do { size_t p_ = (pos); RMF_packedSetLink(tbl->table, p_, (U32)(link)); RMF_packedSetLength(tbl->table, p_, 0); } while(0)
+
+#define GetMatchLink(pos) RMF_packedGetLink(tbl->table, pos)
+
+#define GetInitialMatchLink(pos) RMF_packedGetLink(tbl->table, pos)
+
+#define GetMatchLength(pos) RMF_packedGetLength(tbl->table, pos)
+
+#define SetMatchLink(pos, link, length) RMF_packedSetLink(tbl->table, pos, (U32)(link))
+
+#define SetMatchLength(pos, link, length) RMF_packedSetLength(tbl->table, pos, (U32)(length))
+
+#define SetMatchLinkAndLength(pos, link, length) do { size_t p_ = (pos); RMF_packedSetLink(tbl->table, p_, (U32)(link)); RMF_packedSetLength(tbl->table, p_, (U32)(length)); } while(0)
+
+#define SetNull(pos) RMF_packedSetLink(tbl->table, pos, PACKED_NULL_LINK)
+
+#define IsNull(pos) (RMF_packedGetLink(tbl->table, pos) == PACKED_NULL_LINK)
+
+BYTE* RMF_packedAsOutputBuffer(FL2_matchTable* const tbl, size_t const pos)
+{
+    return (BYTE*)((RMF_packedUnit*)tbl->table + (pos >> 1) + (pos & 1));
+}
+
+/* Restrict the match lengths so that they don't reach beyond pos */
+void RMF_packedLimitLengths(FL2_matchTable* const tbl, size_t const pos)
+{
+    DEBUGLOG(5, "RMF_limitLengths : end %u, max length %u", (U32)pos, RADIX_MAX_LENGTH);
+    SetNull(pos - 1);
+    for (U32 length = 2; length < RADIX_MAX_LENGTH && length <= pos; ++length) {
+        if (!IsNull(pos - length))
+            SetMatchLength(pos - length, 0, MIN(length, GetMatchLength(pos - length)));
+    }
+}
+
+#include "radix_engine.h"
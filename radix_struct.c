@@ -20,27 +20,28 @@
 
 #define RADIX_MAX_LENGTH STRUCTURED_MAX_LENGTH
 
-#define InitMatchLink(pos, link) ((RMF_unit*)tbl->table)[(pos) >> UNIT_BITS].links[(pos) & UNIT_MASK] = (U32)(link)
+#define InitMatchLink(pos, link) RMF_unitTable(tbl->table)[UNIT_INDEX(pos)].links[UNIT_SLOT(pos)] = (U32)(link)
 
-#define GetMatchLink(pos) ((RMF_unit*)tbl->table)[(pos) >> UNIT_BITS].links[(pos) & UNIT_MASK]
+#define GetMatchLink(pos) RMF_unitTable(tbl->table)[UNIT_INDEX(pos)].links[UNIT_SLOT(pos)]
 
-#define GetInitialMatchLink(pos) ((RMF_unit*)tbl->table)[(pos) >> UNIT_BITS].links[(pos) & UNIT_MASK]
+#define GetInitialMatchLink(pos) RMF_unitTable(tbl->table)[UNIT_INDEX(pos)].links[UNIT_SLOT(pos)]
 
-#define GetMatchLength(pos) ((RMF_unit*)tbl->table)[(pos) >> UNIT_BITS].lengths[(pos) & UNIT_MASK]
+#define GetMatchLength(pos) RMF_unitTable(tbl->table)[UNIT_INDEX(pos)].lengths[UNIT_SLOT(pos)]
 
-#define SetMatchLink(pos, link, length) ((RMF_unit*)tbl->table)[(pos) >> UNIT_BITS].links[(pos) & UNIT_MASK] = (U32)(link)
+#define SetMatchLink(pos, link, length) RMF_unitTable(tbl->table)[UNIT_INDEX(pos)].links[UNIT_SLOT(pos)] = (U32)(link)
 
-#define SetMatchLength(pos, link, length) ((RMF_unit*)tbl->table)[(pos) >> UNIT_BITS].lengths[(pos) & UNIT_MASK] = (BYTE)(length)
+#define SetMatchLength(pos, link, length) RMF_unitTable(tbl->table)[UNIT_INDEX(pos)].lengths[UNIT_SLOT(pos)] = (BYTE)(length)
 
-#define SetMatchLinkAndLength(pos, link, length) do { size_t i_ = (pos) >> UNIT_BITS, u_ = (pos) & UNIT_MASK; ((RMF_unit*)tbl->table)[i_].links[u_] = (U32)(link); ((RMF_unit*)tbl->table)[i_].lengths[u_] = (BYTE)(length); } while(0)
+#define SetMatchLinkAndLength(pos, link, length) do { size_t p_ = (pos); RMF_unit* const unit_ = RMF_unitTable(tbl->table) + UNIT_INDEX(p_); size_t const u_ = UNIT_SLOT(p_); unit_->links[u_] = (U32)(link); unit_->lengths[u_] = (BYTE)(length); } while(0)
 
-#define SetNull(pos) ((RMF_unit*)tbl->table)[(pos) >> UNIT_BITS].links[(pos) & UNIT_MASK] = RADIX_NULL_LINK
+#define SetNull(pos) RMF_unitTable(tbl->table)[UNIT_INDEX(pos)].links[UNIT_SLOT(pos)] = RADIX_NULL_LINK
 
-#define IsNull(pos) (((RMF_unit*)tbl->table)[(pos) >> UNIT_BITS].links[(pos) & UNIT_MASK] == RADIX_NULL_LINK)
+#define IsNull(pos) (RMF_unitTable(tbl->table)[UNIT_INDEX(pos)].links[UNIT_SLOT(pos)] == RADIX_NULL_LINK)
 
 BYTE* RMF_structuredAsOutputBuffer(FL2_matchTable* const tbl, size_t const pos)
 {
-    return (BYTE*)((RMF_unit*)tbl->table + (pos >> UNIT_BITS) + ((pos & UNIT_MASK) != 0));
+    MEM_STATIC_ASSERT(sizeof(RMF_unit) == UNIT_POSITIONS * 5 || sizeof(RMF_unit) == UNIT_ALIGN);
+    return (BYTE*)(RMF_unitTable(tbl->table) + UNIT_INDEX(pos) + (UNIT_SLOT(pos) != 0));
 }
 
 /* Restrict the match lengths so that they don't reach beyond pos */
@@ -49,10 +50,10 @@ void RMF_structuredLimitLengths(FL2_matchTable* const tbl, size_t const pos)
     DEBUGLOG(5, "RMF_limitLengths : end %u, max length %u", (U32)pos, RADIX_MAX_LENGTH);
     SetNull(pos - 1);
     for (size_t length = 2; length < RADIX_MAX_LENGTH && length <= pos; ++length) {
-        size_t const i = (pos - length) >> UNIT_BITS;
-        size_t const u = (pos - length) & UNIT_MASK;
-        if (((RMF_unit*)tbl->table)[i].links[u] != RADIX_NULL_LINK) {
-            ((RMF_unit*)tbl->table)[i].lengths[u] = MIN((BYTE)length, ((RMF_unit*)tbl->table)[i].lengths[u]);
+        RMF_unit* const unit = RMF_unitTable(tbl->table) + UNIT_INDEX(pos - length);
+        size_t const u = UNIT_SLOT(pos - length);
+        if (unit->links[u] != RADIX_NULL_LINK) {
+            unit->lengths[u] = MIN((BYTE)length, unit->lengths[u]);
         }
     }
 }
@@ -0,0 +1,218 @@
+/*
+* Copyright (c) 2018, Conor McCarthy
+* All rights reserved.
+*
+* This source code is licensed under both the BSD-style license (found in the
+* LICENSE file in the root directory of this source tree) and the GPLv2 (found
+* in the COPYING file in the root directory of this source tree).
+* You may select, at your option, one of the above-listed licenses.
+*/
+
+/* Suffix array and LCP construction for the suffix array match finder.
+ * The suffix array is built by induced sorting (SA-IS, Nong, Zhang & Chan 2009), which needs
+ * little memory beyond the array itself, and the LCP in text order with the phi method
+ * (Karkkainen, Manzini & Puglisi 2009). */
+
+#include <stdlib.h>     /* malloc, calloc, free */
+#include <string.h>     /* memset */
+#include "mem.h"
+#include "fl2_internal.h"
+#include "radix_internal.h"
+#include "count.h"
+
+/* Level 0 is the block with a virtual sentinel appended, and bytes shifted up by one to
+ * make room for it. Deeper levels are the names of the LMS substrings of the level above,
+ * which end in the name of the sentinel. */
+typedef struct
+{
+    const BYTE* bytes;
+    const S32* names;
+    S32 length;
+} RMF_saString;
+
+#define SA_TYPE_GET(t, i) (((t)[(size_t)(i) >> 3] >> ((i) & 7)) & 1)
+#define SA_TYPE_SET(t, i, b) (t)[(size_t)(i) >> 3] = (BYTE)(((t)[(size_t)(i) >> 3] & ~(1U << ((i) & 7))) | ((unsigned)(b) << ((i) & 7)))
+#define SA_IS_LMS(t, i) ((i) > 0 && SA_TYPE_GET(t, i) && !SA_TYPE_GET(t, (i) - 1))
+
+FORCE_INLINE_TEMPLATE
+S32 RMF_saChar(const RMF_saString* const s, S32 const i)
+{
+    if (s->names != NULL)
+        return s->names[i];
+    return (i + 1 < s->length) ? (S32)s->bytes[i] + 1 : 0;
+}
+
+static void RMF_saBuckets(const RMF_saString* const s, S32* const bkt, S32 const k, int const end)
+{
+    memset(bkt, 0, sizeof(S32) * ((size_t)k + 1));
+    for (S32 i = 0; i < s->length; ++i)
+        ++bkt[RMF_saChar(s, i)];
+    S32 sum = 0;
+    for (S32 i = 0; i <= k; ++i) {
+        sum += bkt[i];
+        bkt[i] = end ? sum : sum - bkt[i];
+    }
+}
+
+/* Induce the positions of the L-type suffixes from the sorted LMS suffixes,
+ * then the S-type suffixes from the L-type */
+static void RMF_saInduce(const RMF_saString* const s, const BYTE* const t, S32* const sa, S32* const bkt, S32 const k)
+{
+    S32 const n = s->length;
+    RMF_saBuckets(s, bkt, k, 0);
+    for (S32 i = 0; i < n; ++i) {
+        S32 const j = sa[i] - 1;
+        if (j >= 0 && !SA_TYPE_GET(t, j))
+            sa[bkt[RMF_saChar(s, j)]++] = j;
+    }
+    RMF_saBuckets(s, bkt, k, 1);
+    for (S32 i = n - 1; i >= 0; --i) {
+        S32 const j = sa[i] - 1;
+        if (j >= 0 && SA_TYPE_GET(t, j))
+            sa[--bkt[RMF_saChar(s, j)]] = j;
+    }
+}
+
+/* Sort the suffixes of s, which has k + 1 symbols and ends in a unique smallest one */
+static int RMF_saSort(const RMF_saString* const s, S32* const sa, S32 const k)
+{
+    S32 const n = s->length;
+    BYTE* const t = calloc(((size_t)n >> 3) + 1, 1);
+    S32* const bkt = malloc(sizeof(S32) * ((size_t)k + 1));
+    if (t == NULL || bkt == NULL) {
+        free(t);
+        free(bkt);
+        return 1;
+    }
+
+    /* Classify each suffix as S-type (1) or L-type (0) */
+    SA_TYPE_SET(t, n - 1, 1);
+    if (n > 1)
+        SA_TYPE_SET(t, n - 2, 0);
+    for (S32 i = n - 3; i >= 0; --i) {
+        S32 const c = RMF_saChar(s, i);
+        S32 const next = RMF_saChar(s, i + 1);
+        SA_TYPE_SET(t, i, c < next || (c == next && SA_TYPE_GET(t, i + 1)));
+    }
+
+    /* Sort the LMS substrings */
+    RMF_saBuckets(s, bkt, k, 1);
+    for (S32 i = 0; i < n; ++i)
+        sa[i] = -1;
+    for (S32 i = 1; i < n; ++i)
+        if (SA_IS_LMS(t, i))
+            sa[--bkt[RMF_saChar(s, i)]] = i;
+    RMF_saInduce(s, t, sa, bkt, k);
+
+    /* Compact the sorted LMS substrings into the first n1 slots and name them */
+    S32 n1 = 0;
+    for (S32 i = 0; i < n; ++i)
+        if (SA_IS_LMS(t, sa[i]))
+            sa[n1++] = sa[i];
+    for (S32 i = n1; i < n; ++i)
+        sa[i] = -1;
+    S32 name = 0;
+    S32 prev = -1;
+    for (S32 i = 0; i < n1; ++i) {
+        S32 const pos = sa[i];
+        int diff = 0;
+        for (S32 d = 0; d < n; ++d) {
+            if (prev == -1
+                || RMF_saChar(s, pos + d) != RMF_saChar(s, prev + d)
+                || SA_TYPE_GET(t, pos + d) != SA_TYPE_GET(t, prev + d))
+            {
+                diff = 1;
+                break;
+            }
+            if (d > 0 && (SA_IS_LMS(t, pos + d) || SA_IS_LMS(t, prev + d)))
+                break;
+        }
+        if (diff) {
+            ++name;
+            prev = pos;
+        }
+        sa[n1 + (pos >> 1)] = name - 1;
+    }
+    for (S32 i = n - 1, j = n - 1; i >= n1; --i)
+        if (sa[i] >= 0)
+            sa[j--] = sa[i];
+
+    /* Sort the LMS suffixes, recursing if any names are repeated */
+    S32* const s1 = sa + n - n1;
+    if (name < n1) {
+        RMF_saString sub;
+        sub.bytes = NULL;
+        sub.names = s1;
+        sub.length = n1;
+        if (RMF_saSort(&sub, sa, name - 1) != 0) {
+            free(t);
+            free(bkt);
+            return 1;
+        }
+    }
+    else {
+        for (S32 i = 0; i < n1; ++i)
+            sa[s1[i]] = i;
+    }
+
+    /* Place the sorted LMS suffixes at the ends of their buckets and induce the rest */
+    RMF_saBuckets(s, bkt, k, 1);
+    for (S32 i = 1, j = 0; i < n; ++i)
+        if (SA_IS_LMS(t, i))
+            s1[j++] = i;
+    for (S32 i = 0; i < n1; ++i)
+        sa[i] = s1[sa[i]];
+    for (S32 i = n1; i < n; ++i)
+        sa[i] = -1;
+    for (S32 i = n1 - 1; i >= 0; --i) {
+        S32 const j = sa[i];
+        sa[i] = -1;
+        sa[--bkt[RMF_saChar(s, j)]] = j;
+    }
+    RMF_saInduce(s, t, sa, bkt, k);
+
+    free(t);
+    free(bkt);
+    return 0;
+}
+
+/* RMF_suffixSort() :
+ * Sort the suffixes of data[0..end). sa must have room for end + 1 values, and on return holds
+ * the sentinel end in sa[0] followed by the sorted positions. end must be less than RMF_SUFFIX_MAX.
+ * Returns 0, or 1 if out of memory. */
+int RMF_suffixSort(const BYTE* const data, S32* const sa, size_t const end)
+{
+    RMF_saString s;
+    s.bytes = data;
+    s.names = NULL;
+    s.length = (S32)end + 1;
+    return RMF_saSort(&s, sa, 256);
+}
+
+/* RMF_suffixLcp() :
+ * Fill plcp[pos] with the length of the prefix shared by the suffix at pos and the one before it
+ * in sa, which holds the end sorted positions. Amortized linear time because each length is at
+ * least one less than that of the position before. */
+void RMF_suffixLcp(const BYTE* const data, const S32* const sa, S32* const plcp, size_t const end)
+{
+    if (end == 0)
+        return;
+    /* phi is built in plcp and replaced by the lengths in text order */
+    plcp[sa[0]] = -1;
+    for (size_t i = 1; i < end; ++i)
+        plcp[sa[i]] = sa[i - 1];
+    size_t length = 0;
+    for (size_t pos = 0; pos < end; ++pos) {
+        S32 const prev = plcp[pos];
+        if (prev < 0) {
+            plcp[pos] = 0;
+            length = 0;
+            continue;
+        }
+        size_t const hi = MAX(pos, (size_t)prev);
+        size_t const lo = MIN(pos, (size_t)prev);
+        length += ZSTD_count(data + hi + length, data + lo + length, data + end);
+        plcp[pos] = (S32)length;
+        length -= (length != 0);
+    }
+}
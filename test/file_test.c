@@ -10,6 +10,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <fast-lzma2.h> /* Assumes that libfast-lzma2 was installed using 'make install' */
 
 static FILE *fin;
@@ -98,6 +99,188 @@ error_out:
     return 1;
 }
 
+/* Compress and decompress src in memory with cctx, and check the output matches */
+static int round_trip(FL2_CCtx *cctx, const unsigned char *src, size_t src_size, int level)
+{
+    size_t const dst_capacity = FL2_compressBound(src_size);
+    unsigned char *const dst = malloc(dst_capacity);
+    unsigned char *const out = malloc(src_size + 1);
+    int ret = 1;
+    if (dst == NULL || out == NULL) {
+        fputs("Cannot allocate test buffers.\n", stderr);
+        goto cleanup;
+    }
+    size_t res = FL2_compressCCtx(cctx, dst, dst_capacity, src, src_size, level);
+    if (!FL2_isError(res))
+        res = FL2_decompress(out, src_size + 1, dst, res);
+    if (FL2_isError(res))
+        fprintf(stderr, "Error at %u bytes, level %d: %s\n", (unsigned)src_size, level, FL2_getErrorName(res));
+    else if (res != src_size || memcmp(out, src, src_size) != 0)
+        fprintf(stderr, "Mismatch at %u bytes, level %d\n", (unsigned)src_size, level);
+    else
+        ret = 0;
+cleanup:
+    free(dst);
+    free(out);
+    return ret;
+}
+
+/* Fill buf with copies of earlier data at random distances and lengths, mixed with random bytes */
+static void fill_test_data(unsigned char *buf, size_t size, unsigned seed)
+{
+    size_t i = 0;
+    while (i < size) {
+        seed = seed * 1103515245U + 12345U;
+        size_t len = 1 + ((seed >> 16) & 63);
+        if (len > size - i)
+            len = size - i;
+        if (i > 64 && (seed & 0x300) != 0) {
+            size_t const dist = 1 + (seed >> 4) % i;
+            for (size_t end = i + len; i < end; ++i)
+                buf[i] = buf[i - dist];
+        }
+        else {
+            for (size_t end = i + len; i < end; ++i) {
+                seed = seed * 1103515245U + 12345U;
+                buf[i] = (unsigned char)(seed >> 23);
+            }
+        }
+    }
+}
+
+/* Inputs of a few bytes leave the encoder's distance price tables empty */
+static int test_tiny_inputs(void)
+{
+    static const unsigned char src[3] = { 'a', 'b', 'a' };
+    FL2_CCtx *const cctx = FL2_createCCtx();
+    int ret = cctx == NULL;
+    for (size_t size = 0; size <= sizeof(src) && !ret; ++size)
+        for (int level = 3; level <= 10 && !ret; level += 7)
+            ret = round_trip(cctx, src, size, level);
+    FL2_freeCCtx(cctx);
+    return ret;
+}
+
+/* Random data is stored after a compressed chunk was attempted, which must fit in the output
+ * buffer of each thread */
+static int test_separate_output(void)
+{
+    static const FL2_encoderParameters variant = { FL2_ultra, 0, 2, 2, 64, 2, 10 };
+    static const size_t sizes[] = { 5000, 20000, 40000, 131072 };
+    static const int levels[] = { 3, 6, 10 };
+    size_t const max_size = sizes[sizeof(sizes) / sizeof(sizes[0]) - 1];
+    unsigned char *const src = malloc(max_size);
+    unsigned seed = 1;
+    int ret = src == NULL;
+    for (size_t i = 0; i < max_size && !ret; ++i) {
+        seed = seed * 1103515245U + 12345U;
+        src[i] = (unsigned char)(seed >> 23);
+    }
+    for (unsigned threads = 1; threads <= 2 && !ret; ++threads) {
+        FL2_CCtx *const cctx = FL2_createCCtxMt(threads);
+        ret = cctx == NULL
+            || FL2_isError(FL2_CCtx_setParameter(cctx, FL2_p_separateOutput, 1))
+            || FL2_isError(FL2_CCtx_setParameter(cctx, FL2_p_sliceSize, FL2_SLICE_SIZE_MIN));
+        for (unsigned variants = 0; variants <= 1 && !ret; ++variants) {
+            ret = FL2_isError(FL2_setCCtxEncoderVariants(cctx, &variant, variants)) != 0;
+            for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]) && !ret; ++i)
+                for (size_t j = 0; j < sizeof(levels) / sizeof(levels[0]) && !ret; ++j)
+                    ret = round_trip(cctx, src, sizes[i], levels[j]);
+        }
+        FL2_freeCCtx(cctx);
+    }
+    free(src);
+    return ret;
+}
+
+/* The encoder uses the links of the suffix array table without checking them */
+static int test_suffix_array(void)
+{
+    static const size_t sizes[] = { 100, 5000, 70000, 300000 };
+    size_t const max_size = sizes[sizeof(sizes) / sizeof(sizes[0]) - 1];
+    unsigned char *const src = malloc(max_size);
+    int ret = src == NULL;
+    if (!ret)
+        fill_test_data(src, max_size, 3);
+    for (unsigned threads = 1; threads <= 2 && !ret; ++threads) {
+        FL2_CCtx *const cctx = FL2_createCCtxMt(threads);
+        ret = cctx == NULL
+            || FL2_isError(FL2_CCtx_setParameter(cctx, FL2_p_suffixArray, 1))
+            || FL2_isError(FL2_CCtx_setParameter(cctx, FL2_p_sliceSize, FL2_SLICE_SIZE_MIN));
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]) && !ret; ++i)
+            for (int level = 3; level <= 10 && !ret; level += 7)
+                ret = round_trip(cctx, src, sizes[i], level);
+        FL2_freeCCtx(cctx);
+    }
+    free(src);
+    return ret;
+}
+
+/* Inputs up to the small input limit use the hash chain table, and larger ones the radix table */
+static int test_small_input(void)
+{
+    static const size_t limit = 16384;
+    size_t const sizes[] = { 1000, limit - 1, limit, limit + 1, limit * 4 };
+    size_t const max_size = sizes[sizeof(sizes) / sizeof(sizes[0]) - 1];
+    unsigned char *const src = malloc(max_size);
+    int ret = src == NULL;
+    if (!ret)
+        fill_test_data(src, max_size, 5);
+    for (unsigned threads = 1; threads <= 2 && !ret; ++threads) {
+        FL2_CCtx *const cctx = FL2_createCCtxMt(threads);
+        ret = cctx == NULL || FL2_isError(FL2_CCtx_setParameter(cctx, FL2_p_smallInput, limit));
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]) && !ret; ++i)
+            for (int level = 1; level <= 10 && !ret; level += 3)
+                ret = round_trip(cctx, src, sizes[i], level);
+        FL2_freeCCtx(cctx);
+    }
+    free(src);
+    return ret;
+}
+
+/* Repeats of period 1 to 8 and of 100 bytes to 16 KB between short random runs */
+static void fill_run_data(unsigned char *buf, size_t size, unsigned seed)
+{
+    size_t i = 0;
+    while (i < size) {
+        seed = seed * 1103515245U + 12345U;
+        size_t const period = 1 + ((seed >> 16) & 7);
+        size_t len = 100 + (seed >> 8) % 16384;
+        if (len > size - i)
+            len = size - i;
+        size_t const start = i;
+        for (size_t end = i + len; i < end; ++i)
+            buf[i] = (i < start + period) ? (unsigned char)(seed >> (i - start)) : buf[i - period];
+        for (size_t end = i + ((seed >> 4) & 31); i < end && i < size; ++i) {
+            seed = seed * 1103515245U + 12345U;
+            buf[i] = (unsigned char)(seed >> 23);
+        }
+    }
+}
+
+/* Linking repeats in init replaces the lists of their positions with direct links */
+static int test_link_repeats(void)
+{
+    static const size_t sizes[] = { 300, 20000, 300000 };
+    size_t const max_size = sizes[sizeof(sizes) / sizeof(sizes[0]) - 1];
+    unsigned char *const src = malloc(max_size);
+    int ret = src == NULL;
+    if (!ret)
+        fill_run_data(src, max_size, 7);
+    for (unsigned threads = 1; threads <= 2 && !ret; ++threads) {
+        FL2_CCtx *const cctx = FL2_createCCtxMt(threads);
+        ret = cctx == NULL
+            || FL2_isError(FL2_CCtx_setParameter(cctx, FL2_p_linkRepeats, 1))
+            || FL2_isError(FL2_CCtx_setParameter(cctx, FL2_p_sliceSize, FL2_SLICE_SIZE_MIN));
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]) && !ret; ++i)
+            for (int level = 1; level <= 10 && !ret; level += 3)
+                ret = round_trip(cctx, src, sizes[i], level);
+        FL2_freeCCtx(cctx);
+    }
+    free(src);
+    return ret;
+}
+
 static void open_files(const char *name)
 {
     fin = fopen(name, "rb");
@@ -163,6 +346,16 @@ int main(int argc, char **argv)
     fseek(fout, 0, SEEK_SET);
     fprintf(stdout, "Decompress %s (Discard the output. XXhash will verify the integrity.):\n", out_name);
     ret = decompress_file(fds);
+    if (ret == 0)
+        ret = test_tiny_inputs();
+    if (ret == 0)
+        ret = test_separate_output();
+    if (ret == 0)
+        ret = test_suffix_array();
+    if (ret == 0)
+        ret = test_small_input();
+    if (ret == 0)
+        ret = test_link_repeats();
     if(ret == 0){
         fprintf(stdout, "Compress & decompress SUCCESS.\n");
     }